@@ -8,6 +8,7 @@
 #include <xv6/param.h>
 #include <xv6/fs.h>
 #include <termios.h>
+#include <poll.h>
 #include "defs.h"
 #include "traps.h"
 #include "spinlock.h"
@@ -138,6 +139,7 @@ consoleintr(int (*getc)(void))
       if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF || (cons.termios.c_lflag & ICANON) == 0){
         input.w = input.e;
         wakeup(&input.r);
+        pollwakeup();
       }
     }
   }
@@ -182,6 +184,19 @@ consoleread(struct inode *ip, char *dst, int n)
   return target - n;
 }
 
+int
+consolepoll(struct inode *ip)
+{
+  int r;
+
+  acquire(&input.lock);
+  r = POLLOUT;
+  if(input.r != input.w)
+    r |= POLLIN;
+  release(&input.lock);
+  return r;
+}
+
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
@@ -220,6 +235,7 @@ consoleinit(void)
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read  = consoleread;
   devsw[CONSOLE].ioctl = consoleioctl;
+  devsw[CONSOLE].poll  = consolepoll;
 
   cons.termios.c_lflag = ECHO | ICANON;
   cons.locking = 1;
@@ -3,6 +3,7 @@ struct context;
 struct file;
 struct inode;
 struct pipe;
+struct iovec;
 struct proc;
 struct rtcdate;
 struct spinlock;
@@ -10,10 +11,13 @@ struct stat;
 struct superblock;
 struct dirent;
 struct dinode;
+struct diriter;
+struct dirstat;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bgetnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
@@ -35,12 +39,31 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filegetdents(struct file*, struct dirstat*, int);
+int             filesendfile(struct file*, struct file*, int);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filepread(struct file*, char*, int, uint);
+int             filepwrite(struct file*, char*, int, uint);
+int             fileseek(struct file*, int, int);
+int             filetruncate(struct file*, uint);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filepoll(struct file*, int);
+void            pollwakeup(void);
+void            polltick(void);
+uint            pollgen(void);
+void            pollsleep(uint, int);
 
 // fs.c
+void            fsinit(int);
 void            readsb(int dev, struct superblock *sb);
+void            diropen(struct diriter*, struct inode*);
+int             dirnext(struct diriter*, struct dirent*);
+void            dirclose(struct diriter*);
+int             dirstats(struct inode*, uint*, uint*, struct dirstat*, int);
 int             dirlink(struct inode*, char*, uint);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
@@ -49,17 +72,18 @@ void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
+void            itrunc(struct inode*, uint);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readipipe(struct inode*, struct pipe*, uint, uint);
+int             readicopy(struct inode*, uint, struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 void            xdip2gaia(char*, struct dinode*);
 void            gdip2x86(struct dinode*, char*);
-void            xdirent2gaia(char*, struct dirent*);
-void            gdirent2x86(struct dirent*, char*);
 
 // ide.c
 void            ideinit(void);
@@ -69,6 +93,7 @@ void            iderw(struct buf*);
 // kalloc.c
 char*           kalloc(void);
 char*           kalloc_with_color(int);
+void            kref(char*);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
@@ -79,6 +104,8 @@ void            kbdintr(void);
 // log.c
 void            initlog(void);
 void            log_write(struct buf*);
+int             log_writeblocks(void);
+void            logdump(void);
 void            begin_op();
 void            end_op();
 
@@ -89,13 +116,19 @@ void            mpinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             piperead(struct pipe*, char*, int, int);
+int             pipewrite(struct pipe*, char*, int, int);
+int             pipepoll(struct pipe*, int);
+int             pipeput(struct pipe*, char*, int);
+int             pipewait(struct pipe*);
+int             piperoom(struct pipe*);
 
 // proc.c
 struct proc*    copyproc(struct proc*);
 void            exit(void);
 int             fork(void);
+int             fdalloc(struct file*);
+void            fdfree(int);
 int             growproc(int);
 int             kill(int);
 void            pinit(void);
@@ -165,7 +198,12 @@ pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
+int             copyin(pde_t*, void*, uint, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+uint            mmapuvm(struct proc*, struct inode*, uint, uint, int, int);
+int             munmapuvm(struct proc*, uint, uint);
+int             copyvma(pde_t*, struct proc*);
+int             mapped(struct proc*, uint, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
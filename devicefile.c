@@ -43,6 +43,7 @@ minrtinit(void)
   devsw[MINRT].write = 0;
   devsw[MINRT].read  = minrtread;
   devsw[MINRT].ioctl = 0;
+  devsw[MINRT].poll  = 0;
 
 }
 
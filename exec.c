@@ -74,6 +74,7 @@ exec(char *path, char **argv)
   oldpgdir = proc->pgdir;
   proc->pgdir = pgdir;
   proc->sz = sz;
+  memset(proc->vma, 0, sizeof(proc->vma));  // freevm drops their pages
   proc->tf->retaddr = 0;  // entry point of user programs
   proc->tf->r30 = sp;
   proc->tf->r31 = sp;
@@ -3,22 +3,137 @@
 //
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <xv6/param.h>
 #include <xv6/fs.h>
 #include "defs.h"
+#include "mmu.h"
 #include "spinlock.h"
 
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
   struct file file[NFILE];
+  struct file *freelist;  // unused files, from file[] or kalloc'd pages
 } ftable;
 
+// poll() waiters sleep on pollq.gen, which any change that can
+// make a file ready bumps. A poller samples gen before checking
+// its files and sleeps only if gen has not moved since, so it
+// cannot miss a change made while it was checking.
+struct {
+  struct spinlock lock;
+  uint gen;
+  int nwait;      // pollers asleep
+  int ntimed;     // of which have a timeout
+} pollq;
+
 void
 fileinit(void)
 {
+  struct file *f;
+
   initlock(&ftable.lock, "ftable");
+  for(f = ftable.file; f < ftable.file + NFILE; f++){
+    f->next = ftable.freelist;
+    ftable.freelist = f;
+  }
+  initlock(&pollq.lock, "pollq");
+}
+
+// A file may have become ready; wake poll().
+void
+pollwakeup(void)
+{
+  acquire(&pollq.lock);
+  pollq.gen++;
+  if(pollq.nwait > 0)
+    wakeup(&pollq.gen);
+  release(&pollq.lock);
+}
+
+// Called every clock tick to let timed polls check the time.
+void
+polltick(void)
+{
+  if(pollq.ntimed > 0)
+    pollwakeup();
+}
+
+// Return the generation to pass to pollsleep().
+uint
+pollgen(void)
+{
+  uint gen;
+
+  acquire(&pollq.lock);
+  gen = pollq.gen;
+  release(&pollq.lock);
+  return gen;
+}
+
+// Sleep until pollwakeup() if nothing has happened since
+// pollgen() returned gen. If timed, wake at the next tick too.
+void
+pollsleep(uint gen, int timed)
+{
+  acquire(&pollq.lock);
+  if(pollq.gen == gen){
+    pollq.nwait++;
+    if(timed)
+      pollq.ntimed++;
+    sleep(&pollq.gen, &pollq.lock);
+    pollq.nwait--;
+    if(timed)
+      pollq.ntimed--;
+  }
+  release(&pollq.lock);
+}
+
+// Return which of the POLL* events are ready on file f.
+// POLLERR and POLLHUP are reported whether asked for or not.
+int
+filepoll(struct file *f, int events)
+{
+  int r;
+
+  r = 0;
+  if(f->type == FD_PIPE)
+    r = pipepoll(f->pipe, f->writable);
+  else if(f->type == FD_INODE){
+    if(f->ip->type == T_DEV && f->ip->major >= 0 && f->ip->major < NDEV &&
+       devsw[f->ip->major].poll)
+      r = devsw[f->ip->major].poll(f->ip);
+    else
+      r = POLLIN | POLLOUT;
+  }
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r & (events | POLLERR | POLLHUP);
+}
+
+// Carve a fresh page into files for the free list, once
+// the NFILE in ftable.file are all open. The pages are never
+// given back. Caller must hold ftable.lock.
+static void
+filegrow(void)
+{
+  struct file *f, *end;
+
+  if((f = (struct file*)kalloc()) == 0)
+    return;
+  memset(f, 0, PGSIZE);
+  end = (struct file*)((char*)f + PGSIZE);
+  for(; f + 1 <= end; f++){
+    f->next = ftable.freelist;
+    ftable.freelist = f;
+  }
 }
 
 // Allocate a file structure.
@@ -28,15 +143,15 @@ filealloc(void)
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.freelist == 0)
+    filegrow();
+  if((f = ftable.freelist) != 0){
+    ftable.freelist = f->next;
+    f->ref = 1;
+    f->dirgen = 0;
   }
   release(&ftable.lock);
-  return 0;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,12 +184,19 @@ fileclose(struct file *f)
   memcpy(&ff,f,sizeof(ff));
   f->ref = 0;
   f->type = FD_NONE;
+  f->next = ftable.freelist;
+  ftable.freelist = f;
   release(&ftable.lock);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
   else if(ff.type == FD_INODE){
     begin_op();
+    if(ff.dirgen){
+      ilock(ff.ip);
+      ff.ip->nwalk--;
+      iunlock(ff.ip);
+    }
     iput(ff.ip);
     end_op();
   }
@@ -93,64 +215,392 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
-// Read from file f.
+// Read up to n directory entries from file f into ds.
 int
-fileread(struct file *f, char *addr, int n)
+filegetdents(struct file *f, struct dirstat *ds, int n)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  begin_op();
+  r = dirstats(f->ip, &f->off, &f->dirgen, ds, n);
+  end_op();
+  return r;
+}
+
+// Read n bytes of inode file f at *off, advancing *off.
+static int
+readat(struct file *f, char *addr, int n, uint *off)
 {
   int r;
 
+  ilock(f->ip);
+  if((r = readi(f->ip, addr, *off, n)) > 0)
+    *off += r;
+  iunlock(f->ip);
+  return r;
+}
+
+// Read from file f.
+int
+fileread(struct file *f, char *addr, int n)
+{
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return piperead(f->pipe, addr, n, f->flags & O_NONBLOCK);
   if(f->type == FD_INODE){
+    // a device with no input must not block a nonblocking read
+    if((f->flags & O_NONBLOCK) && filepoll(f, POLLIN) == 0)
+      return -1;
+    return readat(f, addr, n, &f->off);
+  }
+  panic("fileread");
+}
+
+// Move n bytes from file in to pipe out, straight from the
+// buffer cache. No locks are held while waiting for the reader.
+// If out is nonblocking, stop instead once the pipe is full.
+static int
+sendpipe(struct file *out, struct file *in, int n)
+{
+  int r, tot, nonblock;
+
+  nonblock = out->flags & O_NONBLOCK;
+  for(tot = 0; tot < n; tot += r){
+    if(!nonblock && pipewait(out->pipe) < 0)
+      return tot > 0 ? tot : -1;
+    ilock(in->ip);
+    if(in->off >= in->ip->size){
+      iunlock(in->ip);
+      break;
+    }
+    if((r = readipipe(in->ip, out->pipe, in->off, n - tot)) > 0)
+      in->off += r;
+    iunlock(in->ip);
+    if(r < 0 || (nonblock && r == 0))
+      return tot > 0 ? tot : -1;
+  }
+  return tot;
+}
+
+// Move n bytes between two regular files straight from the
+// buffer cache, in transactions sized like writeat()'s.
+// The inodes are locked in inum order, so two sendfile()s
+// going opposite ways cannot deadlock.
+static int
+sendinode(struct file *out, struct file *in, int n)
+{
+  struct inode *a, *b;
+  int r, tot, max;
+
+  a = in->ip;
+  b = out->ip;
+  if(a->inum > b->inum){
+    a = out->ip;
+    b = in->ip;
+  }
+  max = log_writeblocks() * BSIZE;
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    begin_op();
+    ilock(a);
+    ilock(b);
+    if(out->flags & O_APPEND)
+      out->off = out->ip->size;
+    r = readicopy(in->ip, in->off, out->ip, out->off,
+                  n - tot < max ? n - tot : max);
+    if(r > 0){
+      in->off += r;
+      out->off += r;
+    }
+    iunlock(b);
+    iunlock(a);
+    end_op();
+    if(r <= 0)
+      break;
+  }
+  if(r < 0 && tot == 0)
+    return -1;
+  return tot;
+}
+
+// Move up to n bytes from in to out through a kernel page, for
+// files sendpipe() and sendinode() cannot handle. Like read(), it
+// returns once a pipe or device in has no more data ready instead
+// of waiting for all n. For a nonblocking pipe out it reads only
+// what the pipe has room for, then writes that even if it must
+// wait, so no byte read from in is dropped.
+static int
+sendcopy(struct file *out, struct file *in, int n)
+{
+  char *buf;
+  int m, r, tot, seekable;
+
+  seekable = in->type == FD_INODE && in->ip->type != T_DEV;
+  if((buf = kalloc()) == 0)
+    return -1;
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    if(tot > 0 && !seekable && filepoll(in, POLLIN) == 0)
+      break;
+    m = n - tot < PGSIZE ? n - tot : PGSIZE;
+    if(out->type == FD_PIPE && (out->flags & O_NONBLOCK)){
+      if((r = piperoom(out->pipe)) == 0){
+        r = -1;
+        break;
+      }
+      if(m > r)
+        m = r;
+    }
+    if((r = fileread(in, buf, m)) <= 0)
+      break;
+    if(out->type == FD_PIPE)
+      m = pipewrite(out->pipe, buf, r, 0);
+    else
+      m = filewrite(out, buf, r);
+    if(m != r){
+      r = -1;
+      break;
+    }
+  }
+  kfree(buf);
+  if(r < 0 && tot == 0)
+    return -1;
+  return tot;
+}
+
+// Move up to n bytes from file in to file out inside the kernel.
+// Return the number of bytes moved, 0 at end of file.
+int
+filesendfile(struct file *out, struct file *in, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && in->ip->type != T_DEV && out->type == FD_PIPE)
+    return sendpipe(out, in, n);
+  if(in->type == FD_INODE && in->ip->type == T_FILE &&
+     out->type == FD_INODE && out->ip->type == T_FILE && in->ip != out->ip)
+    return sendinode(out, in, n);
+  return sendcopy(out, in, n);
+}
+
+// Write n bytes to inode file f at *off, advancing *off.
+// If append, each piece first moves *off to the end of the
+// file under the inode lock, so concurrent appends never
+// overwrite each other.
+static int
+writeat(struct file *f, char *addr, int n, uint *off, int append)
+{
+  int r;
+
+  // write a few blocks at a time to avoid exceeding
+  // the log space reserved for one op (see begin_op
+  // and log_writeblocks).
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = log_writeblocks() * BSIZE;
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_op();
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
+    if(append)
+      *off = f->ip->size;
+    if ((r = writei(f->ip, addr + i, *off, n1)) > 0)
+      *off += r;
     iunlock(f->ip);
-    return r;
+    end_op();
+
+    if(r < 0)
+      break;
+    if(r != n1)
+      panic("short filewrite");
+    i += r;
   }
-  panic("fileread");
+  return i == n ? n : -1;
 }
 
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((LOGSIZE-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+    return pipewrite(f->pipe, addr, n, f->flags & O_NONBLOCK);
+  if(f->type == FD_INODE)
+    return writeat(f, addr, n, &f->off, f->flags & O_APPEND);
+  panic("filewrite");
+}
+
+// Read into the cnt buffers of iov in turn. An inode file is
+// read under one lock; a pipe or device fills only the first
+// nonempty buffer, since reading on could block with data in hand.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->readable == 0)
+    return -1;
+  for(i = 0; i < cnt && iov[i].iov_len == 0; i++)
+    ;
+  if(i == cnt)
+    return 0;
+  if(f->type != FD_INODE || f->ip->type == T_DEV)
+    return fileread(f, iov[i].iov_base, iov[i].iov_len);
+  tot = 0;
+  ilock(f->ip);
+  for(; i < cnt; i++){
+    if((r = readi(f->ip, iov[i].iov_base, f->off, iov[i].iov_len)) < 0)
+      break;
+    f->off += r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  iunlock(f->ip);
+  return r < 0 && tot == 0 ? -1 : tot;
+}
+
+// Write the cnt buffers of iov in turn. For an inode file,
+// consecutive buffers share a log transaction as long as
+// together they fit in one write's share of the log.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, n1, room, done, tot, max;
 
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_PIPE){
+    for(tot = 0, i = 0; i < cnt; i++){
+      r = pipewrite(f->pipe, iov[i].iov_base, iov[i].iov_len,
+                    f->flags & O_NONBLOCK);
       if(r < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
+  }
+  if(f->type != FD_INODE)
+    panic("filewritev");
+
+  // the buffers land at consecutive offsets, so they touch the
+  // same blocks as one write() of their total; see writeat().
+  max = log_writeblocks() * BSIZE;
+  tot = done = r = 0;
+  i = 0;
+  while(i < cnt && r >= 0){
+    begin_op();
+    ilock(f->ip);
+    if(f->flags & O_APPEND)
+      f->off = f->ip->size;
+    for(room = max; i < cnt && room > 0; ){
+      n1 = iov[i].iov_len - done;
+      if(n1 > room)
+        n1 = room;
+      if((r = writei(f->ip, (char*)iov[i].iov_base + done, f->off, n1)) < 0)
         break;
       if(r != n1)
-        panic("short filewrite");
-      i += r;
+        panic("short filewritev");
+      f->off += r;
+      tot += r;
+      room -= r;
+      done += r;
+      if(done == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
     }
-    return i == n ? n : -1;
+    iunlock(f->ip);
+    end_op();
   }
-  panic("filewrite");
+  return r < 0 ? -1 : tot;
+}
+
+// Files with an offset: not pipes or devices.
+static int
+seekable(struct file *f)
+{
+  return f->type == FD_INODE && f->ip->type != T_DEV;
+}
+
+// Read from file f at offset off, leaving f->off alone.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  if(f->readable == 0 || !seekable(f))
+    return -1;
+  return readat(f, addr, n, &off);
+}
+
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  if(f->writable == 0 || !seekable(f))
+    return -1;
+  return writeat(f, addr, n, &off, 0);
+}
+
+// Set the size of inode file f to len, freeing the blocks
+// past it or writing zeros up to it.
+int
+filetruncate(struct file *f, uint len)
+{
+  char *zero;
+  uint off;
+  int r;
+
+  if(f->writable == 0 || !seekable(f) || f->ip->type != T_FILE)
+    return -1;
+  begin_op();
+  ilock(f->ip);
+  itrunc(f->ip, len);
+  off = f->ip->size;
+  iunlock(f->ip);
+  end_op();
+  if(off >= len)
+    return 0;
+
+  // The file has no holes, so growing it writes the zeros.
+  if((zero = kalloc()) == 0)
+    return -1;
+  memset(zero, 0, PGSIZE);
+  for(r = 0; off < len && r >= 0; )
+    r = writeat(f, zero, len - off < PGSIZE ? len - off : PGSIZE, &off, 0);
+  kfree(zero);
+  return r < 0 ? -1 : 0;
+}
+
+// Set the offset of file f to off, taken relative to whence
+// (SEEK_SET, SEEK_CUR or SEEK_END). The file has no holes, so
+// the offset may not pass the end. Return the new offset.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  if(!seekable(f))
+    return -1;
+  ilock(f->ip);
+  if(whence == SEEK_CUR)
+    off += f->off;
+  else if(whence == SEEK_END)
+    off += f->ip->size;
+  else if(whence != SEEK_SET)
+    off = -1;
+  if(off < 0 || off > f->ip->size){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = off;
+  iunlock(f->ip);
+  return off;
 }
@@ -22,7 +22,28 @@
 #include "assert.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-static void itrunc(struct inode*);
+static void dcache_init(void);
+static void dcache_purge(uint, uint);
+static void dxcheck(struct inode*);
+
+// In-memory copy of the super block, the layout of on-disk
+// records it selects, and block allocator state.
+// There should be one per disk device, but we run with
+// only one device.
+struct {
+  struct spinlock lock;
+  struct superblock sb;
+  uint ipb;      // inodes per block
+  uint dinsize;  // bytes per on-disk inode
+  uint desize;   // bytes per directory entry
+  uint nfree;    // number of free blocks
+  uint hint;     // balloc() starts looking here
+} fsb;
+
+#define NATIVE (fsb.sb.flags & SB_NATIVE)
+
+// The log sits above the data blocks, at the end of the disk.
+#define DATAEND (fsb.sb.size - fsb.sb.nlog)
 
 // Read the super block.
 void
@@ -35,13 +56,51 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
-// Zero a block.
+// Set up the file system on dev: cache the super block,
+// recover the log, and count the free blocks.
+// Must be called from a process, since initlog() may sleep.
+void
+fsinit(int dev)
+{
+  int b, bi;
+  struct buf *bp;
+
+  initlock(&fsb.lock, "fsb");
+  readsb(dev, &fsb.sb);
+  if(fsb.sb.bsize != BSIZE)
+    panic("fsinit: block size");
+  if(NATIVE){
+    fsb.ipb = NIPB;
+    fsb.dinsize = NDINSIZE;
+    fsb.desize = NDIRSIZE;
+  } else {
+    fsb.ipb = IPB;
+    fsb.dinsize = XDINSIZE;
+    fsb.desize = XDIRSIZE;
+  }
+  initlog();
+
+  fsb.nfree = 0;
+  fsb.hint = DATAEND;
+  for(b = 0; b < DATAEND; b += BPB){
+    bp = bread(dev, BBLOCK(b, fsb.sb.ninodes, fsb.ipb));
+    for(bi = 0; bi < BPB && b + bi < DATAEND; bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+        if(fsb.nfree++ == 0)
+          fsb.hint = b + bi;
+      }
+    }
+    brelse(bp);
+  }
+}
+
+// Zero a block. Its old contents do not matter, so do not read it.
 static void
 bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bgetnew(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
@@ -49,43 +108,107 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+#define BFREE(bp, bi) (((bp)->data[(bi)/8] & (1 << ((bi) % 8))) == 0)
+
+// Allocate a zeroed disk block, preferably the first of run
+// free blocks in a row so that the caller can grow a file
+// contiguously with ballocat().
+// The search starts at fsb.hint, just past the last block
+// allocated, so appending to a file does not rescan the
+// bitmap from the start; it wraps around to pick up blocks
+// freed below the hint.
 static uint
-balloc(uint dev)
+ballocrun(uint dev, int run)
 {
-  int b, bi, m;
+  int b, bi, k, m, n;
   struct buf *bp;
-  struct superblock sb;
 
-  bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  acquire(&fsb.lock);
+  if(fsb.nfree == 0)
+    panic("balloc: out of blocks");
+  b = fsb.hint;
+  release(&fsb.lock);
+
+  for(n = 0; n <= fsb.sb.size/BPB + 1; n++){
+    if(b >= DATAEND)
+      b = 0;
+    bi = b % BPB;
+    b -= bi;
+    bp = bread(dev, BBLOCK(b, fsb.sb.ninodes, fsb.ipb));
+    for(; bi < BPB && b + bi < DATAEND; bi++){
       m = 1 << (bi % 8);
+      if(m == 1 && bp->data[bi/8] == 0xff){
+        bi += 7;  // skip a full byte
+        continue;
+      }
       if((bp->data[bi/8] & m) == 0){  // Is block free?
+        for(k = 1; k < run && bi + k < BPB && b + bi + k < DATAEND; k++)
+          if(!BFREE(bp, bi + k))
+            break;
+        if(k < run && bi + k < BPB && b + bi + k < DATAEND){
+          bi += k;  // too short a run
+          continue;
+        }
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
         brelse(bp);
+        acquire(&fsb.lock);
+        fsb.nfree--;
+        fsb.hint = b + bi + k;  // leave the run for ballocat()
+        release(&fsb.lock);
         bzero(dev, b + bi);
         return b + bi;
       }
     }
     brelse(bp);
+    b += BPB;
   }
+  if(run > 1)
+    return ballocrun(dev, 1);
   panic("balloc: out of blocks");
 }
 
+static uint
+balloc(uint dev)
+{
+  return ballocrun(dev, 1);
+}
+
+// Allocate block b, zeroed, if it is free; return 0 if not.
+static uint
+ballocat(uint dev, uint b)
+{
+  struct buf *bp;
+  int bi;
+
+  if(b >= DATAEND)
+    return 0;
+  bp = bread(dev, BBLOCK(b, fsb.sb.ninodes, fsb.ipb));
+  bi = b % BPB;
+  if(!BFREE(bp, bi)){
+    brelse(bp);
+    return 0;
+  }
+  bp->data[bi/8] |= 1 << (bi % 8);
+  log_write(bp);
+  brelse(bp);
+  acquire(&fsb.lock);
+  fsb.nfree--;
+  if(fsb.hint == b)
+    fsb.hint = b + 1;
+  release(&fsb.lock);
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
   struct buf *bp;
-  struct superblock sb;
   int bi, m;
 
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
+  bp = bread(dev, BBLOCK(b, fsb.sb.ninodes, fsb.ipb));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
@@ -93,6 +216,11 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&fsb.lock);
+  fsb.nfree++;
+  if(b < fsb.hint)
+    fsb.hint = b;
+  release(&fsb.lock);
 }
 
 // Inodes.
@@ -120,18 +248,20 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, iput() frees if
 //   the link count has fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() to find or
-//   create a cache entry and increment its ref, iput()
-//   to decrement ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and
+//   current directories). iget() to find or create a
+//   cache entry and increment its ref, iput() to
+//   decrement ref. An entry whose ref is zero sits on
+//   the LRU list and may be recycled by iget().
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when the I_VALID bit
 //   is set in ip->flags. ilock() reads the inode from
 //   the disk and sets I_VALID, while iput() clears
-//   I_VALID if ip->ref has fallen to zero.
+//   I_VALID if it frees the inode. An unreferenced entry
+//   stays valid until recycled, so reopening a recently
+//   used file does not read the inode from disk again.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -157,40 +287,113 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+
+  // Cached inodes hashed by (dev, inum), through hnext.
+  struct inode *hash[NIHASH];
+
+  // Linked list of entries with ref == 0, through prev/next.
+  // lru.next is most recently used. Entries that are not
+  // valid go at the tail, to be recycled first.
+  struct inode lru;
 } icache;
 
+// Put ip on the LRU list; icache.lock must be held.
+static void
+lruput(struct inode *ip)
+{
+  struct inode *at;
+
+  at = (ip->flags & I_VALID) ? &icache.lru : icache.lru.prev;
+  ip->next = at->next;
+  ip->prev = at;
+  at->next->prev = ip;
+  at->next = ip;
+}
+
+static void
+lrudel(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
 void
 iinit(void)
 {
+  struct inode *ip;
+
   initlock(&icache.lock, "icache");
+  dcache_init();
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++)
+    lruput(ip);
+}
+
+// All entries are referenced: add a page of new ones
+// to the LRU list. icache.lock must be held.
+static int
+igrow(void)
+{
+  struct inode *ip, *end;
+
+  if((ip = (struct inode*)kalloc()) == 0)
+    return -1;
+  memset(ip, 0, PGSIZE);
+  end = (struct inode*)((char*)ip + PGSIZE);
+  for(; ip + 1 <= end; ip++)
+    lruput(ip);
+  return 0;
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// On-disk inode inum within its inode block bp.
+static char*
+dinode(struct buf *bp, uint inum)
+{
+  return (char*)bp->data + (inum % fsb.ipb) * fsb.dinsize;
+}
+
+static int
+dinode_type(char *dip)
+{
+  if(NATIVE)
+    return ((struct ndinode*)dip)->type;
+  return (uchar)dip[0] | ((uchar)dip[1] << 8);
+}
+
 // Allocate a new inode with the given type on device dev.
 // A free inode has a type of zero.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int inum, major;
   struct buf *bp;
-  struct dinode *dip;
-  struct superblock sb;
-  struct dinode gdip;
-
-  readsb(dev, &sb);
-
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum));
-    dip = (struct dinode*)((uint)bp->data + (inum%IPB)*XDINSIZE);
-    xdip2gaia((char*)dip, &gdip);
-    if(gdip.type == 0){  // a free inode
-      memset(&gdip, 0, sizeof(gdip));
-      gdip.type = type;
-      gdip2x86(&gdip, (char*)dip);
+  char *dip;
+
+  for(inum = 1; inum < fsb.sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, fsb.ipb));
+    dip = dinode(bp, inum);
+    if(dinode_type(dip) == 0){  // a free inode
+      memset(dip, 0, fsb.dinsize);
+      major = 0;
+      if(type == T_FILE && (fsb.sb.flags & SB_EXTENTS))
+        major = D_EXTENTS;
+      if(NATIVE){
+        ((struct ndinode*)dip)->type = type;
+        ((struct ndinode*)dip)->major = major;
+      } else {
+        dip[0] = type;
+        dip[1] = type >> 8;
+        dip[2] = major;
+      }
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
@@ -205,19 +408,27 @@ void
 iupdate(struct inode *ip)
 {
   struct buf *bp;
-  struct dinode *dip;
+  struct ndinode *ndip;
   struct dinode gdip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum));
-  dip = (struct dinode*)((uint)bp->data + (ip->inum%IPB)*XDINSIZE);
-  xdip2gaia((char*)dip, &gdip);
-  gdip.type = ip->type;
-  gdip.major = ip->major;
-  gdip.minor = ip->minor;
-  gdip.nlink = ip->nlink;
-  gdip.size = ip->size;
-  memmove(gdip.addrs, ip->addrs, sizeof(ip->addrs));
-  gdip2x86(&gdip, (char*)dip);
+  bp = bread(ip->dev, IBLOCK(ip->inum, fsb.ipb));
+  if(NATIVE){
+    ndip = (struct ndinode*)dinode(bp, ip->inum);
+    ndip->type = ip->type;
+    ndip->major = ip->major;
+    ndip->minor = ip->minor;
+    ndip->nlink = ip->nlink;
+    ndip->size = ip->size;
+    memmove(ndip->addrs, ip->addrs, sizeof(ip->addrs));
+  } else {
+    gdip.type = ip->type;
+    gdip.major = ip->major;
+    gdip.minor = ip->minor;
+    gdip.nlink = ip->nlink;
+    gdip.size = ip->size;
+    memmove(gdip.addrs, ip->addrs, sizeof(ip->addrs));
+    gdip2x86(&gdip, dinode(bp, ip->inum));
+  }
   log_write(bp);
   brelse(bp);
 }
@@ -228,31 +439,40 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip != 0; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lrudel(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used inode cache entry.
+  if(icache.lru.prev == &icache.lru && igrow() < 0)
     panic("iget: no inodes");
+  ip = icache.lru.prev;
+  lrudel(ip);
+  if(ip->inum != 0){
+    pp = &icache.hash[IHASH(ip->dev, ip->inum)];
+    while(*pp != ip)
+      pp = &(*pp)->hnext;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->nwalk = 0;
+  ip->dgen = 1;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -275,7 +495,7 @@ void
 ilock(struct inode *ip)
 {
   struct buf *bp;
-  struct dinode *dip;
+  struct ndinode *ndip;
   struct dinode gdip;
 
   if(ip == 0 || ip->ref < 1)
@@ -288,20 +508,31 @@ ilock(struct inode *ip)
   release(&icache.lock);
 
   if(!(ip->flags & I_VALID)){
-    bp = bread(ip->dev, IBLOCK(ip->inum));
-    dip = (struct dinode*)((uint)bp->data + (ip->inum%IPB)*XDINSIZE);
-    xdip2gaia((char*)dip, &gdip);
-    ip->type  = gdip.type;
-    ip->major = gdip.major;
-    ip->minor = gdip.minor;
-    ip->nlink = gdip.nlink;
-    ip->size  = gdip.size;
-    memmove(ip->addrs, gdip.addrs, sizeof(ip->addrs));
-    gdip2x86(&gdip, (char*)dip);
+    bp = bread(ip->dev, IBLOCK(ip->inum, fsb.ipb));
+    if(NATIVE){
+      ndip = (struct ndinode*)dinode(bp, ip->inum);
+      ip->type  = ndip->type;
+      ip->major = ndip->major;
+      ip->minor = ndip->minor;
+      ip->nlink = ndip->nlink;
+      ip->size  = ndip->size;
+      memmove(ip->addrs, ndip->addrs, sizeof(ip->addrs));
+    } else {
+      xdip2gaia(dinode(bp, ip->inum), &gdip);
+      ip->type  = gdip.type;
+      ip->major = gdip.major;
+      ip->minor = gdip.minor;
+      ip->nlink = gdip.nlink;
+      ip->size  = gdip.size;
+      memmove(ip->addrs, gdip.addrs, sizeof(ip->addrs));
+    }
     brelse(bp);
+    ip->nmap = 0;
     ip->flags |= I_VALID;
     if(ip->type == 0)
       panic("ilock: no type");
+    if(ip->type == T_DIR && (ip->major & D_INDEXED))
+      dxcheck(ip);
   }
 }
 
@@ -319,8 +550,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry goes
+// on the LRU list and can be recycled.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -335,14 +566,16 @@ iput(struct inode *ip)
       panic("iput busy");
     ip->flags |= I_BUSY;
     release(&icache.lock);
-    itrunc(ip);
+    itrunc(ip, 0);
     ip->type = 0;
     iupdate(ip);
+    dcache_purge(ip->dev, ip->inum);
     acquire(&icache.lock);
     ip->flags = 0;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruput(ip);
   release(&icache.lock);
 }
 
@@ -359,72 +592,352 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the NDINDIRECT after
+// that in the blocks listed in block ip->addrs[NDIRECT+1].
+//
+// Looking up a block through an indirect block also saves the
+// addresses of the next few file blocks in ip->map[], so that
+// sequential access reads each indirect block once per NBMAP
+// blocks rather than once per block.
+
+// Return entry i of indirect block addr of ip, allocating a
+// block if it is zero, and cache the entries from i on, which
+// are the addresses of file blocks fbn on.
+static uint
+bmapind(struct inode *ip, uint addr, uint i, uint fbn)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = balloc(ip->dev);
+    log_write(bp);
+  }
+  ip->mapbn = fbn;
+  for(ip->nmap = 0; ip->nmap < NBMAP && i + ip->nmap < NINDIRECT; ip->nmap++)
+    ip->map[ip->nmap] = a[i + ip->nmap];
+  brelse(bp);
+  return addr;
+}
+
+static uint bmap(struct inode*, uint);
+
+// Install addr as block bn of block-mapped inode ip.
+static void
+bmapput(struct inode *ip, uint bn, uint addr)
+{
+  uint *a, ind;
+  struct buf *bp;
+
+  if(bn < NDIRECT){
+    ip->addrs[bn] = addr;
+    return;
+  }
+  bn -= NDIRECT;
+  if(bn < NINDIRECT){
+    if((ind = ip->addrs[NDIRECT]) == 0)
+      ip->addrs[NDIRECT] = ind = balloc(ip->dev);
+  } else {
+    bn -= NINDIRECT;
+    if(ip->addrs[NDIRECT+1] == 0)
+      ip->addrs[NDIRECT+1] = balloc(ip->dev);
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    a = (uint*)bp->data;
+    if((ind = a[bn / NINDIRECT]) == 0){
+      a[bn / NINDIRECT] = ind = balloc(ip->dev);
+      log_write(bp);
+    }
+    brelse(bp);
+    bn %= NINDIRECT;
+  }
+  bp = bread(ip->dev, ind);
+  ((uint*)bp->data)[bn] = addr;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Extent-mapped files (see fs.h). ip->map[0] caches the first
+// block of the run that starts at file block ip->mapbn and is
+// ip->nmap blocks long.
+#define EXTRUN 8  // free blocks wanted after the start of a new run
+
+// Return run i of extent-mapped inode ip, reading the extent block
+// into *bpp if needed, or 0 if there is no extent block yet.
+static uint*
+extent(struct inode *ip, int i, struct buf **bpp)
+{
+  if(i < NDEXTENT)
+    return &ip->addrs[2*i];
+  if(*bpp == 0){
+    if(ip->addrs[NDIRECT+1] == 0)
+      return 0;
+    *bpp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+  }
+  return (uint*)(*bpp)->data + 2*(i - NDEXTENT);
+}
+
+// Turn extent-mapped inode ip into a block-mapped one.
+static void
+eunmap(struct inode *ip)
+{
+  uint runs[2*NDEXTENT], eb, fbn, b, *e;
+  struct buf *bp;
+  int i;
+
+  // The block map reuses addrs[], so take the runs out first.
+  memmove(runs, ip->addrs, sizeof(runs));
+  eb = ip->addrs[NDIRECT+1];
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->major &= ~D_EXTENTS;
+  ip->nmap = 0;
+
+  fbn = 0;
+  for(i = 0; i < NDEXTENT; i++)
+    for(b = 0; b < runs[2*i+1]; b++)
+      bmapput(ip, fbn++, runs[2*i] + b);
+  if(eb){
+    bp = bread(ip->dev, eb);
+    for(i = 0; i < NIEXTENT; i++){
+      e = (uint*)bp->data + 2*i;
+      for(b = 0; b < e[1]; b++)
+        bmapput(ip, fbn++, e[0] + b);
+    }
+    brelse(bp);
+    bfree(ip->dev, eb);
+  }
+}
+
+// Number of indirect blocks a block map of nb blocks uses.
+static uint
+nindirect(uint nb)
+{
+  if(nb <= NDIRECT)
+    return 0;
+  if(nb <= NDIRECT + NINDIRECT)
+    return 1;
+  return 2 + (nb - NDIRECT - NINDIRECT + NINDIRECT - 1) / NINDIRECT;
+}
+
+// Indirect blocks one write transaction has room to log; see
+// log_writeblocks(). eunmap() logs every indirect block of the
+// new block map in the transaction that switches, so a file
+// must switch while its map still needs no more than this.
+#define EUNMAPIND 3
+
+// bmap() for extent-mapped inodes. Blocks are only ever added
+// at the end of the file, by growing the last run if the next
+// disk block is free and starting a new run otherwise, until
+// the runs are used up and the file switches to the block map.
+// A file also switches once a write could take it past the
+// size whose map fits in one transaction, so it never runs out
+// of runs when it is too big to switch. mkfs only marks files
+// of at most EXTMAX blocks as extent-mapped, which are small enough.
+static uint
+ebmap(struct inode *ip, uint bn)
+{
+  struct buf *bp;
+  uint *e, *last, addr, fbn;
+  int i;
+
+  if(bn - ip->mapbn < ip->nmap)
+    return ip->map[0] + bn - ip->mapbn;
+
+  bp = 0;
+  last = 0;
+  fbn = 0;
+  for(i = 0; i < NDEXTENT + NIEXTENT; i++){
+    if((e = extent(ip, i, &bp)) == 0 || e[1] == 0)
+      break;
+    if(bn < fbn + e[1]){
+      ip->mapbn = fbn;
+      ip->nmap = e[1];
+      ip->map[0] = e[0];
+      if(bp)
+        brelse(bp);
+      return e[0] + bn - fbn;
+    }
+    fbn += e[1];
+    last = e;
+  }
+  if(bn != fbn)
+    panic("ebmap");
+  if(i == NDEXTENT + NIEXTENT ||
+     nindirect(bn + log_writeblocks()) > EUNMAPIND){
+    // Out of runs, or about to be too big to switch later:
+    // carry on with the block map.
+    if(bp)
+      brelse(bp);
+    eunmap(ip);
+    return bmap(ip, bn);
+  }
+
+  addr = 0;
+  if(last && (addr = ballocat(ip->dev, last[0] + last[1])) != 0){
+    last[1]++;
+    e = last;
+  } else {
+    if(e == 0){
+      ip->addrs[NDIRECT+1] = balloc(ip->dev);
+      e = extent(ip, i, &bp);
+    }
+    e[0] = addr = ballocrun(ip->dev, EXTRUN);
+    e[1] = 1;
+  }
+  if(bp){
+    if(addr)
+      log_write(bp);
+    brelse(bp);
+  }
+  ip->nmap = 0;
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, fbn;
+
+  if(ip->type == T_FILE && (ip->major & D_EXTENTS))
+    return ebmap(ip, bn);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
       ip->addrs[bn] = addr = balloc(ip->dev);
     return addr;
   }
+  if(bn - ip->mapbn < ip->nmap && (addr = ip->map[bn - ip->mapbn]) != 0)
+    return addr;
+  fbn = bn;
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
       ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+    return bmapind(ip, addr, bn, fbn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double indirect block, then the indirect block in it.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev);
+    addr = bmapind(ip, addr, bn / NINDIRECT, 0);
+    return bmapind(ip, addr, bn % NINDIRECT, fbn);
   }
 
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Only called when the inode has no links
-// to it (no directory entries referring to it)
-// and has no in-memory reference to it (is
-// not an open file or current directory).
+// Free the blocks listed in indirect block addr, descending
+// depth more levels of indirection, except for the first keep
+// file blocks under it. If keep is 0, free addr itself too.
 static void
-itrunc(struct inode *ip)
+ifree(struct inode *ip, uint addr, int depth, uint keep)
 {
-  int i, j;
+  int j, dirty;
+  uint span, sub;
   struct buf *bp;
   uint *a;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
+  span = depth > 0 ? NINDIRECT : 1;
+  dirty = 0;
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0 || (j+1)*span <= keep)
+      continue;
+    sub = j*span >= keep ? 0 : keep - j*span;
+    if(depth > 0)
+      ifree(ip, a[j], depth - 1, sub);
+    else
+      bfree(ip->dev, a[j]);
+    if(sub == 0 && keep > 0){
+      a[j] = 0;
+      dirty = 1;
     }
   }
+  if(dirty)
+    log_write(bp);
+  brelse(bp);
+  if(keep == 0)
+    bfree(ip->dev, addr);
+}
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+// Truncate inode ip to len bytes, freeing the blocks past
+// the end; does nothing if ip is already no longer than that.
+// Caller must hold ip->lock and be inside a transaction.
+void
+itrunc(struct inode *ip, uint len)
+{
+  int i, n, dirty;
+  uint b, k, nb, fbn, keep, *e;
+  struct buf *bp;
+
+  if(len >= ip->size && len > 0)
+    return;
+  nb = (len + BSIZE - 1) / BSIZE;
+
+  if(ip->type == T_FILE && (ip->major & D_EXTENTS)){
+    bp = 0;
+    fbn = 0;
+    n = 0;
+    dirty = 0;
+    for(i = 0; i < NDEXTENT + NIEXTENT; i++){
+      if((e = extent(ip, i, &bp)) == 0 || e[1] == 0)
+        break;
+      b = e[1];
+      if(fbn + b > nb){
+        for(k = fbn < nb ? nb - fbn : 0; k < b; k++)
+          bfree(ip->dev, e[0] + k);
+        if(fbn < nb)
+          e[1] = nb - fbn;
+        else
+          e[0] = e[1] = 0;
+        if(i >= NDEXTENT)
+          dirty = 1;
+      }
+      if(e[1])
+        n++;
+      fbn += b;
+    }
+    if(bp){
+      if(dirty)
+        log_write(bp);
+      brelse(bp);
+    }
+    if(n <= NDEXTENT && ip->addrs[NDIRECT+1]){
+      bfree(ip->dev, ip->addrs[NDIRECT+1]);
+      ip->addrs[NDIRECT+1] = 0;
+    }
+  } else {
+    for(i = nb; i < NDIRECT; i++){
+      if(ip->addrs[i]){
+        bfree(ip->dev, ip->addrs[i]);
+        ip->addrs[i] = 0;
+      }
+    }
+
+    keep = nb > NDIRECT ? nb - NDIRECT : 0;
+    if(ip->addrs[NDIRECT] && keep < NINDIRECT){
+      ifree(ip, ip->addrs[NDIRECT], 0, keep);
+      if(keep == 0)
+        ip->addrs[NDIRECT] = 0;
+    }
+    keep = nb > NDIRECT + NINDIRECT ? nb - NDIRECT - NINDIRECT : 0;
+    if(ip->addrs[NDIRECT+1]){
+      ifree(ip, ip->addrs[NDIRECT+1], 1, keep);
+      if(keep == 0)
+        ip->addrs[NDIRECT+1] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  ip->nmap = 0;
 
-  ip->size = 0;
+  ip->size = len;
   iupdate(ip);
 }
 
@@ -466,6 +979,62 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Move up to n bytes of ip at off straight from the buffer
+// cache into pipe p, stopping when the pipe is full rather than
+// sleeping with a buffer held. Return the number of bytes moved,
+// or -1 if the pipe has no reader. Caller holds ip->lock.
+int
+readipipe(struct inode *ip, struct pipe *p, uint off, uint n)
+{
+  uint tot, m;
+  int r;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=m, off+=m){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = pipeput(p, (char*)bp->data + off%BSIZE, m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m)
+      return tot + r;
+  }
+  return n;
+}
+
+// Copy up to n bytes of ip at off into dst at doff, writing each
+// block of ip into dst straight from its buffer. Return the number
+// of bytes copied, short at the end of ip, or -1. Caller holds both
+// locks and is inside a transaction sized for n bytes of dst.
+int
+readicopy(struct inode *ip, uint off, struct inode *dst, uint doff, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=m, off+=m, doff+=m){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    if(writei(dst, (char*)bp->data + off%BSIZE, doff, m) != m){
+      brelse(bp);
+      return tot > 0 ? tot : -1;
+    }
+    brelse(bp);
+  }
+  return n;
+}
+
 // Write data to inode.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
@@ -481,12 +1050,15 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(n > 0 && (off + n - 1)/BSIZE >= MAXFILE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(m == BSIZE)  // whole block: no need to read it first
+      bp = bgetnew(ip->dev, bmap(ip, off/BSIZE));
+    else
+      bp = bread(ip->dev, bmap(ip, off/BSIZE));
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
@@ -507,6 +1079,490 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entries are fsb.desize bytes, used in place.
+static uint
+de_inum(uchar *p)
+{
+  if(NATIVE)
+    return ((struct ndirent*)p)->inum;
+  return p[0] | (p[1] << 8);
+}
+
+static char*
+de_name(uchar *p)
+{
+  if(NATIVE)
+    return ((struct ndirent*)p)->name;
+  return (char*)p + 2;
+}
+
+static void
+de_set(uchar *p, uint inum, char *name)
+{
+  memset(p, 0, fsb.desize);
+  if(NATIVE)
+    ((struct ndirent*)p)->inum = inum;
+  else {
+    p[0] = inum;
+    p[1] = inum >> 8;
+  }
+  strncpy(de_name(p), name, DIRSIZ);
+}
+
+// Iterate over the entries of locked directory dp, empty ones
+// included, a block at a time:
+//
+//   diropen(&it, dp);
+//   while(dirnext(&it, &de))
+//     ... de is the entry at offset it.off ...
+//   dirclose(&it);
+//
+// The iterator holds the current block's buffer, so the caller
+// must dirclose() before writing to the directory.
+void
+diropen(struct diriter *it, struct inode *dp)
+{
+  if(dp->type != T_DIR)
+    panic("diropen not DIR");
+  it->dp = dp;
+  it->off = 0;
+  it->next = 0;
+  it->bp = 0;
+}
+
+int
+dirnext(struct diriter *it, struct dirent *de)
+{
+  uchar *p;
+
+  if(it->next + fsb.desize > it->dp->size)
+    return 0;
+  if(it->bp == 0 || it->next % BSIZE == 0){
+    if(it->bp)
+      brelse(it->bp);
+    it->bp = bread(it->dp->dev, bmap(it->dp, it->next / BSIZE));
+  }
+  p = it->bp->data + it->next % BSIZE;
+  de->inum = de_inum(p);
+  memmove(de->name, de_name(p), DIRSIZ);
+  it->off = it->next;
+  it->next += fsb.desize;
+  return 1;
+}
+
+void
+dirclose(struct diriter *it)
+{
+  if(it->bp)
+    brelse(it->bp);
+  it->bp = 0;
+}
+
+// Directory name lookup cache: remembers (directory, name) -> inum
+// for recent lookups, so that resolving a hot path does not read
+// the directories along it.  An entry with inum 0 records that the
+// name is not in the directory.  Callers hold the directory's inode
+// lock, and every change to a directory's contents goes through
+// dirlink() or dirunlink(), which keep the cache in step.
+#define NDCACHE 128
+
+struct dcentry {
+  uint dev;
+  uint dir;           // directory inum, 0 if the slot is unused
+  char name[DIRSIZ];
+  uint inum;          // 0 for a negative entry
+  uint off;           // offset of the entry in the directory
+};
+
+struct {
+  struct spinlock lock;
+  struct dcentry e[NDCACHE];
+} dcache;
+
+static void
+dcache_init(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dcentry*
+dcache_slot(struct inode *dp, char *name)
+{
+  uint h;
+  int i;
+
+  h = dp->dev * 31 + dp->inum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.e[h % NDCACHE];
+}
+
+// Look name up in the cache.  Returns 1 and sets *pinum (0 if the
+// name is known to be absent) and *poff on a hit, 0 on a miss.
+static int
+dcache_lookup(struct inode *dp, char *name, uint *pinum, uint *poff)
+{
+  struct dcentry *e;
+  int hit;
+
+  acquire(&dcache.lock);
+  e = dcache_slot(dp, name);
+  hit = e->dir == dp->inum && e->dev == dp->dev && namecmp(e->name, name) == 0;
+  if(hit){
+    *pinum = e->inum;
+    *poff = e->off;
+  }
+  release(&dcache.lock);
+  return hit;
+}
+
+static void
+dcache_enter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  e = dcache_slot(dp, name);
+  e->dev = dp->dev;
+  e->dir = dp->inum;
+  strncpy(e->name, name, DIRSIZ);
+  e->inum = inum;
+  e->off = off;
+  release(&dcache.lock);
+}
+
+// Name has been removed from directory dp.
+static void
+dcache_remove(struct inode *dp, char *name)
+{
+  dcache_enter(dp, name, 0, 0);
+}
+
+// Inode inum has been freed: drop entries in it or naming it,
+// since the inum may be reused.
+static void
+dcache_purge(uint dev, uint inum)
+{
+  struct dcentry *e;
+
+  acquire(&dcache.lock);
+  for(e = &dcache.e[0]; e < &dcache.e[NDCACHE]; e++)
+    if(e->dev == dev && (e->dir == inum || e->inum == inum))
+      e->dir = 0;
+  release(&dcache.lock);
+}
+
+// Indexed directories: extendible hashing over whole blocks.
+// The index table lives in the name bytes of entries 2.. of
+// block 0 (see fs.h).  A leaf that fills up is split in two by
+// the next hash bit, doubling the table when needed; a leaf's
+// depth is implied by how many table slots point at it.
+// A flat directory is converted when its first block fills up.
+// A name whose leaf stays full goes elsewhere and marks its table
+// slot DXOVER, so only names hashing to that slot lose the direct
+// lookup; the directory stays indexed and the leaf is split again
+// by the next insertion into it. Splitting moves entries, so it
+// is not done while a getdents() walk is part way through the
+// directory (dp->nwalk), lest the walk see them twice. Converting
+// does not wait, since the directory might never be indexed then;
+// it bumps dp->dgen, and a walk that sees that starts over.
+//
+// Log blocks written by one dirlink() into a directory:
+//   flat:    entry block, inode, 2 bitmap, 2 indirect (6)
+//   convert: block 0, 2 leaves, inode, 2 bitmap (6)
+//   split:   block 0, 2 leaves, inode, 2 bitmap, indirect (7)
+//   no room: block 0, new block, inode, 2 bitmap, 2 indirect (7)
+// since a split never happens twice, nor with a convert, and
+// leaves are only split within the single-indirect blocks.
+// create() adds the new inode and, for a directory, its first
+// block and a bitmap block; that is MAXOPBLOCKS.
+#define DIRPB     (BSIZE / fsb.desize)  // entries per block
+#define DXSLOT    2                     // first entry used by the index
+#define DXLEAFMAX (NDIRECT + NINDIRECT) // leaves are below this block
+
+// Largest table depth that fits in block 0.
+static int
+dxmaxdepth(void)
+{
+  int depth;
+
+  depth = 0;
+  while(2 + 2*(2 << depth) <= (DIRPB - DXSLOT) * DIRSIZ)
+    depth++;
+  return depth;
+}
+
+// FNV-1a; tools/mkfs.c has a copy.
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261u;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Byte i of the index area of block 0.
+static uchar*
+dxbyte(struct buf *bp, int i)
+{
+  return (uchar*)de_name(bp->data + (DXSLOT + i/DIRSIZ)*fsb.desize) + i%DIRSIZ;
+}
+
+// Slot i of the table, with DXOVER.
+static uint
+dxget(struct buf *bp, int i)
+{
+  return *dxbyte(bp, 2+2*i) | (*dxbyte(bp, 3+2*i) << 8);
+}
+
+static void
+dxset(struct buf *bp, int i, uint bn)
+{
+  *dxbyte(bp, 2+2*i) = bn;
+  *dxbyte(bp, 3+2*i) = bn >> 8;
+}
+
+// Look for name in block bn of directory dp.
+static uint
+dxscan(struct inode *dp, uint bn, char *name, uint *poff)
+{
+  struct buf *bp;
+  uchar *p;
+  uint inum;
+  int i;
+
+  inum = 0;
+  bp = bread(dp->dev, bmap(dp, bn));
+  for(i = 0; i < DIRPB; i++){
+    p = bp->data + i*fsb.desize;
+    if(de_inum(p) != 0 && namecmp(name, de_name(p)) == 0){
+      inum = de_inum(p);
+      *poff = bn*BSIZE + i*fsb.desize;
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+static uint
+dxlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  uint slot, bn, inum;
+
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
+    return dxscan(dp, 0, name, poff);
+  bp = bread(dp->dev, bmap(dp, 0));
+  slot = dxget(bp, dirhash(name) & ((1 << *dxbyte(bp, 0)) - 1));
+  brelse(bp);
+  if((inum = dxscan(dp, slot & ~DXOVER, name, poff)) != 0 ||
+     !(slot & DXOVER))
+    return inum;
+  for(bn = 1; bn < dp->size/BSIZE && inum == 0; bn++)
+    inum = dxscan(dp, bn, name, poff);
+  return inum;
+}
+
+// Called by ilock() for an indexed directory: if an older kernel
+// has added an entry over the index header (see fs.h), the table
+// can no longer be trusted, so read dp as a flat directory. The
+// in-memory major is enough; the next iupdate() makes it stick.
+static void
+dxcheck(struct inode *dp)
+{
+  struct buf *bp;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  if(de_inum(bp->data + DXSLOT*fsb.desize) != 0 ||
+     *dxbyte(bp, 1) != DXMAGIC)
+    dp->major &= ~D_INDEXED;
+  brelse(bp);
+}
+
+// Move the entries from entry first on of block from into the
+// free entries of block to: those whose hash has bit set, or
+// all of them if bit is 0.
+static void
+dxmove(struct inode *dp, struct buf *from, int first,
+       struct buf *to, uint tobn, uint bit)
+{
+  uchar *p, *q;
+  int i, j;
+
+  j = 0;
+  for(i = first; i < DIRPB; i++){
+    p = from->data + i*fsb.desize;
+    if(de_inum(p) == 0 || (bit && (dirhash(de_name(p)) & bit) == 0))
+      continue;
+    while(de_inum(to->data + j*fsb.desize) != 0)
+      j++;
+    q = to->data + j*fsb.desize;
+    memmove(q, p, fsb.desize);
+    memset(p, 0, fsb.desize);
+    dcache_enter(dp, de_name(q), de_inum(q), tobn*BSIZE + j*fsb.desize);
+  }
+}
+
+// Append a zeroed block to directory dp and return its number.
+static uint
+dxgrow(struct inode *dp)
+{
+  uint bn;
+
+  bn = dp->size / BSIZE;
+  bmap(dp, bn);
+  dp->size += BSIZE;
+  return bn;
+}
+
+// Turn flat directory dp, whose only block is full, into an
+// indexed one with two leaves.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *b0, *l0, *l1;
+  uint bn0, bn1;
+
+  if(dp->size != BSIZE)
+    return -1;
+  b0 = bread(dp->dev, bmap(dp, 0));
+  if(namecmp(de_name(b0->data), ".") != 0 ||
+     namecmp(de_name(b0->data + fsb.desize), "..") != 0){
+    brelse(b0);
+    return -1;
+  }
+  bn0 = dxgrow(dp);
+  bn1 = dxgrow(dp);
+  l0 = bread(dp->dev, bmap(dp, bn0));
+  l1 = bread(dp->dev, bmap(dp, bn1));
+  dxmove(dp, b0, DXSLOT, l1, bn1, 1);
+  dxmove(dp, b0, DXSLOT, l0, bn0, 0);
+  memset(b0->data + DXSLOT*fsb.desize, 0, BSIZE - DXSLOT*fsb.desize);
+  *dxbyte(b0, 0) = 1;
+  *dxbyte(b0, 1) = DXMAGIC;
+  dxset(b0, 0, bn0);
+  dxset(b0, 1, bn1);
+  log_write(b0);
+  log_write(l0);
+  log_write(l1);
+  brelse(b0);
+  brelse(l0);
+  brelse(l1);
+  dp->major |= D_INDEXED;
+  dp->dgen++;
+  iupdate(dp);
+  return 0;
+}
+
+// Split leaf bn of indexed directory dp, whose block 0 is b0.
+// Returns the new leaf, or 0 if it cannot be split.
+static uint
+dxsplit(struct inode *dp, struct buf *b0, uint bn)
+{
+  struct buf *from, *to;
+  int i, n, depth;
+  uint bit, nbn;
+
+  depth = *dxbyte(b0, 0);
+  n = 0;
+  for(i = 0; i < (1 << depth); i++)
+    if((dxget(b0, i) & ~DXOVER) == bn)
+      n++;
+  if((n == 1 && depth == dxmaxdepth()) || dp->size/BSIZE >= DXLEAFMAX)
+    return 0;
+  if(n == 1){
+    // Leaf is at full depth: double the table.
+    for(i = 0; i < (1 << depth); i++)
+      dxset(b0, i + (1 << depth), dxget(b0, i));
+    *dxbyte(b0, 0) = ++depth;
+    n = 2;
+  }
+  nbn = dxgrow(dp);
+  iupdate(dp);
+
+  // The leaf's entries agree on their low depth-log2(n) hash bits;
+  // the next bit decides which of the two leaves they go to.
+  bit = (1 << depth) / n;
+  for(i = 0; i < (1 << depth); i++)
+    if((dxget(b0, i) & ~DXOVER) == bn && (i & bit))
+      dxset(b0, i, nbn | (dxget(b0, i) & DXOVER));
+  from = bread(dp->dev, bmap(dp, bn));
+  to = bread(dp->dev, bmap(dp, nbn));
+  dxmove(dp, from, 0, to, nbn, bit);
+  log_write(b0);
+  log_write(from);
+  log_write(to);
+  brelse(from);
+  brelse(to);
+  return nbn;
+}
+
+// Return the first free entry of block bn of directory dp, with
+// the block in *bpp, or -1 if the block is full.
+static int
+dxfree(struct inode *dp, uint bn, struct buf **bpp)
+{
+  int i;
+
+  *bpp = bread(dp->dev, bmap(dp, bn));
+  for(i = 0; i < DIRPB; i++)
+    if(de_inum((*bpp)->data + i*fsb.desize) == 0)
+      return i;
+  brelse(*bpp);
+  return -1;
+}
+
+// Add (name, inum) to indexed directory dp.
+static void
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *b0, *bp;
+  uint h, k, bn, nbn;
+  int i;
+
+  h = dirhash(name);
+  b0 = bread(dp->dev, bmap(dp, 0));
+  k = h & ((1 << *dxbyte(b0, 0)) - 1);
+  bn = dxget(b0, k) & ~DXOVER;
+  if((i = dxfree(dp, bn, &bp)) < 0 && dp->nwalk == 0 &&
+     (nbn = dxsplit(dp, b0, bn)) != 0){
+    k = h & ((1 << *dxbyte(b0, 0)) - 1);
+    if((dxget(b0, k) & ~DXOVER) == nbn){
+      nbn = bn;
+      bn = dxget(b0, k) & ~DXOVER;
+    }
+    if((i = dxfree(dp, bn, &bp)) < 0){
+      // Every entry went to this half, so the other one is empty.
+      dxset(b0, k, dxget(b0, k) | DXOVER);
+      log_write(b0);
+      bn = nbn;
+      i = dxfree(dp, bn, &bp);
+    }
+  } else if(i < 0){
+    // Leaf full and cannot be split now: any free entry will do.
+    dxset(b0, k, dxget(b0, k) | DXOVER);
+    log_write(b0);
+    for(bn = 1; bn < dp->size/BSIZE; bn++)
+      if((i = dxfree(dp, bn, &bp)) >= 0)
+        break;
+    if(i < 0){
+      bn = dxgrow(dp);
+      iupdate(dp);
+      i = dxfree(dp, bn, &bp);
+    }
+  }
+  de_set(bp->data + i*fsb.desize, inum, name);
+  log_write(bp);
+  brelse(bp);
+  brelse(b0);
+  dcache_enter(dp, name, inum, bn*BSIZE + i*fsb.desize);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -514,26 +1570,47 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
-  char xde[XDIRSIZE];
+  struct diriter it;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(xde)){
-    if(readi(dp, xde, off, sizeof(xde)) != sizeof(xde))
-      panic("dirlink read");
-    xdirent2gaia(xde, &de);
+  if(dcache_lookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  if(dp->major & D_INDEXED){
+    if((inum = dxlookup(dp, name, &off)) == 0){
+      dcache_enter(dp, name, 0, 0);
+      return 0;
+    }
+    dcache_enter(dp, name, inum, off);
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
+  diropen(&it, dp);
+  while(dirnext(&it, &de)){
     if(de.inum == 0)
       continue;
     if(namecmp(name, de.name) == 0){
       // entry matches path element
+      dirclose(&it);
       if(poff)
-        *poff = off;
+        *poff = it.off;
       inum = de.inum;
+      dcache_enter(dp, name, inum, it.off);
       return iget(dp->dev, inum);
     }
   }
+  dirclose(&it);
 
+  dcache_enter(dp, name, 0, 0);
   return 0;
 }
 
@@ -542,9 +1619,10 @@ int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
-  struct dirent de, de2;
-  char xde[XDIRSIZE];
+  struct dirent de;
+  uchar xde[NDIRSIZE];
   struct inode *ip;
+  struct diriter it;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -552,24 +1630,119 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dp->major & D_INDEXED){
+    dxlink(dp, name, inum);
+    return 0;
+  }
+
   // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(xde)){
-    if(readi(dp, xde, off, sizeof(xde)) != sizeof(xde))
-      panic("dirlink read");
-    xdirent2gaia(xde, &de);
-    if(de.inum == 0)
+  off = dp->size;
+  diropen(&it, dp);
+  while(dirnext(&it, &de)){
+    if(de.inum == 0){
+      off = it.off;
       break;
+    }
+  }
+  dirclose(&it);
+  if(off == BSIZE && dxconvert(dp) == 0){
+    dxlink(dp, name, inum);
+    return 0;
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  gdirent2x86(&de, xde);
-  if(writei(dp, xde, off, sizeof(xde)) != sizeof(xde))
+  de_set(xde, inum, name);
+  if(writei(dp, (char*)xde, off, fsb.desize) != fsb.desize)
     panic("dirlink");
+  dcache_enter(dp, name, inum, off);
 
   return 0;
 }
 
+// Remove the entry for name, at offset off, from directory dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  uchar xde[NDIRSIZE];
+
+  memset(xde, 0, sizeof(xde));
+  if(writei(dp, (char*)xde, off, fsb.desize) != fsb.desize)
+    panic("unlink: writei");
+  dcache_remove(dp, name);
+}
+
+// Fill ds with up to n entries of directory dp, starting at
+// byte offset *poff, and advance *poff past them. The entries'
+// inodes are referenced while dp is locked, so an unlink cannot
+// free one before it is stat'ed.
+// From the first call until the walk reaches the end, *pgen holds
+// dp->dgen and the walk is counted in dp->nwalk, so dirlink() does
+// not move entries under the offset; if dp is converted anyway,
+// the walk starts over (see the index code above).
+// Must be called inside a transaction since it calls iput().
+#define NDIRSTAT 16
+
+int
+dirstats(struct inode *dp, uint *poff, uint *pgen, struct dirstat *ds, int n)
+{
+  struct diriter it;
+  struct dirent de;
+  struct inode *ips[NDIRSTAT];
+  int i, m, tot;
+
+  ilock(dp);
+  if(dp->type != T_DIR){
+    iunlock(dp);
+    return -1;
+  }
+  if(*pgen == 0)
+    dp->nwalk++;
+  else if(*pgen != dp->dgen)
+    *poff = 0;
+  *pgen = dp->dgen;
+  diropen(&it, dp);
+  it.next = (*poff + fsb.desize - 1) / fsb.desize * fsb.desize;
+  tot = 0;
+  while(tot < n){
+    // Collect a batch of names with dp locked...
+    for(m = 0; m < NDIRSTAT && tot + m < n && dirnext(&it, &de); ){
+      if(de.inum == 0)
+        continue;
+      ds[tot+m].ino = de.inum;
+      memmove(ds[tot+m].name, de.name, DIRSIZ);
+      ds[tot+m].name[DIRSIZ] = 0;
+      ips[m++] = iget(dp->dev, de.inum);
+    }
+    if(m == 0)
+      break;
+    dirclose(&it);
+    iunlock(dp);
+
+    // ...then stat them without it, since "." and ".." may be dp
+    // or its parent.
+    for(i = 0; i < m; i++){
+      ilock(ips[i]);
+      ds[tot+i].type = ips[i]->type;
+      ds[tot+i].size = ips[i]->size;
+      iunlockput(ips[i]);
+    }
+    ilock(dp);
+    tot += m;
+    if(*pgen != dp->dgen){  // converted meanwhile
+      *pgen = dp->dgen;
+      it.next = 0;
+      tot = 0;
+    }
+  }
+  *poff = it.next;
+  dirclose(&it);
+  if(*poff >= dp->size){
+    dp->nwalk--;
+    *pgen = 0;
+  }
+  iunlock(dp);
+  return tot;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -680,7 +1853,7 @@ xdip2gaia(char* xdin, struct dinode* gdin){
   gdin->nlink = ((short)c1) + (((short)c2)<<8);
 
   gdin->size  = *((uint*)(xdin + 8));
-  memmove(gdin->addrs, (uint*)(xdin + 12), sizeof(uint)*(NDIRECT+1));
+  memmove(gdin->addrs, (uint*)(xdin + 12), sizeof(uint)*(NDIRECT+2));
 }
 
 void
@@ -689,25 +1862,5 @@ gdip2x86(struct dinode* gdin, char* xdin){
   *((uint*)(xdin + 4)) = (gdin->minor) | (gdin->nlink << 16);
 
   *((uint*)(xdin + 8)) = gdin->size;
-  memmove((uint*)(xdin + 12), gdin->addrs, sizeof(uint)*(NDIRECT+1));
-}
-
-void
-xdirent2gaia(char* xdir, struct dirent* gdir){
-  int i;
-  uint xdir_cont = *(uint*)xdir;
-  gdir->inum     = (ushort)(((*(uint*)xdir) & 0x0000ffff));
-
-  assert((DIRSIZ - 2) % 4 == 0);
-  memmove(gdir->name, xdir+2, DIRSIZ);
-}
-
-void
-gdirent2x86(struct dirent* gdir, char* xdir){
-  int i;
-  *(xdir) = gdir->inum & 0xff;
-  *(xdir+1) = (gdir->inum & 0xff00) >> 8;
-
-  assert((DIRSIZ - 2) % 4 == 0);
-  memmove(xdir+2, gdir->name, DIRSIZ);
+  memmove((uint*)(xdin + 12), gdin->addrs, sizeof(uint)*(NDIRECT+2));
 }
@@ -5,7 +5,20 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_TRUNC   0x400
+#define O_NONBLOCK 0x800
+#define O_APPEND  0x1000
+
+#define F_GETFL   3  // fcntl(): get O_* flags
+#define F_SETFL   4  // fcntl(): set O_NONBLOCK and O_APPEND
+
+#ifndef SEEK_SET
+#define SEEK_SET  0  // lseek() from the start of the file
+#define SEEK_CUR  1  // from the current offset
+#define SEEK_END  2  // from the end of the file
+#endif
 
 int open(const char *, int);
+int fcntl(int, int, int);
 
 #endif
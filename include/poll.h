@@ -0,0 +1,21 @@
+#ifndef _XV6_POLL_H
+#define _XV6_POLL_H
+
+#define POLLIN   0x01  // read will not block
+#define POLLOUT  0x04  // write will not block
+#define POLLERR  0x08  // write end of a pipe with no reader
+#define POLLHUP  0x10  // read end of a pipe with no writer
+#define POLLNVAL 0x20  // fd is not open
+
+// One file descriptor of a poll() call
+struct pollfd {
+  int fd;       // File descriptor
+  int events;   // Events of interest
+  int revents;  // Events that occurred
+};
+
+// Wait until one of nfds files is ready or timeout clock ticks
+// have passed; a negative timeout waits forever.
+int poll(struct pollfd *, int nfds, int timeout);
+
+#endif
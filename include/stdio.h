@@ -13,6 +13,12 @@
 #define BUFSIZ 1024
 #define OPEN_MAX 10
 
+#ifndef SEEK_SET
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+#endif
+
 typedef struct _iobuf {
   int  cnt;    /* characters left */
   char *ptr;   /* next character position */
@@ -59,6 +65,8 @@ char *gets(char *);
 
 FILE *fopen(const char *, const char *);
 int fclose(FILE *);
+int fseek(FILE *, long, int);
+long ftell(FILE *);
 
 int printf(const char *, ...);
 int fprintf(FILE *, const char *, ...);
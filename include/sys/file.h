@@ -6,9 +6,13 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  int flags;      // O_NONBLOCK
+  uint dirgen;    // getdents() walk: ip->dgen, 0 if none; see dirstats()
+  struct file *next; // ftable free list
 };
 
 #define NADDR 13
+#define NBMAP 8
 
 // in-memory copy of an inode
 struct inode {
@@ -22,17 +26,38 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NADDR];  // NADDR is equal to NDIRECT + 1 on xv6 file system. NDIRECT is defined in fs.h
+  uint addrs[NADDR];  // NADDR is equal to NDIRECT + 2 on xv6 file system. NDIRECT is defined in fs.h
+
+  uint mapbn;         // bmap() cache: addresses of file blocks
+  uint nmap;          // mapbn .. mapbn+nmap-1, from an indirect block
+  uint map[NBMAP];
+
+  int nwalk;          // getdents() walks part way through this dir
+  uint dgen;          // bumped when a flat dir becomes indexed
+
+  struct inode *hnext; // icache hash chain
+  struct inode *prev;  // icache LRU list
+  struct inode *next;
 };
 #define I_BUSY 0x1
 #define I_VALID 0x2
 
+// cursor over the entries of a locked directory;
+// see diropen() in fs.c
+struct diriter {
+  struct inode *dp;
+  uint off;           // offset of the entry last returned
+  uint next;          // offset of the next entry
+  struct buf *bp;     // block holding next, if any
+};
+
 // table mapping major device number to
 // device functions
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
   int (*ioctl)(struct inode*, int);
+  int (*poll)(struct inode*);  // POLL* events ready, if not 0
 };
 
 extern struct devsw devsw[];
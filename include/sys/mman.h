@@ -0,0 +1,21 @@
+#ifndef _XV6_SYS_MMAN_H
+#define _XV6_SYS_MMAN_H
+
+#define PROT_READ   0x1  // pages may be read
+#define PROT_WRITE  0x2  // pages may be written
+
+#define MAP_SHARED  0x01 // share changes (anonymous memory only)
+#define MAP_PRIVATE 0x02 // changes are private to the process
+#define MAP_ANON    0x20 // zeroed memory, not backed by a file
+
+#define MAP_FAILED  ((void*)-1)
+
+// Map len bytes of fd starting at offset off, which must be
+// page-aligned, or len zeroed bytes if flags has MAP_ANON.
+// MAP_SHARED|MAP_ANON memory stays shared with fork children.
+// addr is only a hint and is ignored.
+void *mmap(void *addr, uint len, int prot, int flags, int fd, uint off);
+// Unmap the pages in [addr, addr+len).
+int munmap(void *addr, uint len);
+
+#endif
@@ -9,3 +9,11 @@ struct stat {
   short nlink; // Number of links to file
   uint size;   // Size of file in bytes
 };
+
+// Directory entry returned by getdents()
+struct dirstat {
+  uint ino;      // Inode number
+  int type;      // Type of file
+  uint size;     // Size of file in bytes
+  char name[16]; // Nul-terminated name, at most DIRSIZ characters
+};
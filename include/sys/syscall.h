@@ -23,3 +23,15 @@
 #define SYS_halt   22
 #define SYS_ioctl  23
 #define SYS_procdump 24
+#define SYS_getdents 25
+#define SYS_sendfile 26
+#define SYS_lseek  27
+#define SYS_pread  28
+#define SYS_pwrite 29
+#define SYS_readv  30
+#define SYS_writev 31
+#define SYS_poll   32
+#define SYS_fcntl  33
+#define SYS_mmap   34
+#define SYS_munmap 35
+#define SYS_ftruncate 36
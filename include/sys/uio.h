@@ -0,0 +1,12 @@
+#ifndef _XV6_SYS_UIO_H
+#define _XV6_SYS_UIO_H
+
+#define IOV_MAX 16  // most buffers one readv() or writev() takes
+
+// One buffer of a readv() or writev() call
+struct iovec {
+  void *iov_base; // Start of the buffer
+  uint iov_len;   // Size of the buffer in bytes
+};
+
+#endif
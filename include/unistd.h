@@ -4,10 +4,18 @@
 #include <stddef.h>
 
 struct stat;
+struct dirstat;
+struct iovec;
 struct rtcdate;
 
 ssize_t write(int, const void *, size_t);
 ssize_t read(int, void *, size_t);
+ssize_t pread(int, void *, size_t, int);
+ssize_t pwrite(int, const void *, size_t, int);
+int lseek(int, int, int);
+int ftruncate(int, int);
+ssize_t readv(int, const struct iovec *, int);
+ssize_t writev(int, const struct iovec *, int);
 int close(int);
 
 int fork(void);
@@ -19,6 +27,8 @@ int exec(char*, char**);
 int mknod(char*, short, short);
 int unlink(char*);
 int fstat(int fd, struct stat*);
+int getdents(int fd, struct dirstat*, int);
+int sendfile(int out, int in, int n);
 int link(char*, char*);
 int mkdir(char*);
 int chdir(char*);
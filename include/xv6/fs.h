@@ -1,17 +1,23 @@
 // On-disk file system format.
 // Both the kernel and user programs use this header file.
 
+// Blocks are BSIZE bytes, a multiple of the SECTSIZE-byte disk
+// sector; sb.bsize records the size an image was made with.
 // Block 0 is unused.
 // Block 1 is super block.
 // Blocks 2 through sb.ninodes/IPB hold inodes.
 // Then free bitmap blocks holding sb.size bits.
 // Then sb.nblocks data blocks.
 // Then sb.nlog log blocks.
+// Inodes and directory entries are in the x86 layout of struct
+// dinode and struct dirent or, if sb.flags has SB_NATIVE, are
+// struct ndinode and struct ndirent.
 #ifndef _XV6_FS_H
 #define _XV6_FS_H
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define SECTSIZE 512  // disk sector size
+#define BSIZE 1024    // block size
 
 // File system super block
 struct superblock {
@@ -19,11 +25,17 @@ struct superblock {
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
   uint nlog;         // Number of log blocks
+  uint flags;        // SB_* below; zero in older images
+  uint bsize;        // Block size (bytes); must equal BSIZE
 };
 
-#define NDIRECT 12
+#define SB_NATIVE 0x1  // inodes and dirents are struct ndinode/ndirent
+#define SB_EXTENTS 0x2 // new files are extent-mapped (D_EXTENTS)
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -32,22 +44,37 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
-#define XDINSIZE      (12 + 4*(NDIRECT+1))
+#define XDINSIZE      (12 + 4*(NDIRECT+2))
+
+// Native on-disk inode structure. It has only word fields, so
+// the kernel can use it in place instead of converting from the
+// x86 layout of struct dinode.
+struct ndinode {
+  uint type;
+  uint major;
+  uint minor;
+  uint nlink;
+  uint size;
+  uint addrs[NDIRECT+2];
+};
+
+#define NDINSIZE      (20 + 4*(NDIRECT+2))
 
 // Inodes per block.
 #define IPB           (BSIZE / XDINSIZE)
+#define NIPB          (BSIZE / NDINSIZE)
 
 // Block containing inode i
-#define IBLOCK(i)     ((i) / IPB + 2)
+#define IBLOCK(i, ipb) ((i) / (ipb) + 2)
 
 // Bitmap bits per block
 #define BPB           (BSIZE*8)
 
 // Block containing bit for block b
-#define BBLOCK(b, ninodes) (b/BPB + (ninodes)/IPB + 3)
+#define BBLOCK(b, ninodes, ipb) (b/BPB + (ninodes)/(ipb) + 3)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
@@ -59,4 +86,41 @@ struct dirent {
 
 #define XDIRSIZE      (2 + (DIRSIZ))
 
+// Native directory entry, padded to divide BSIZE.
+struct ndirent {
+  uint inum;
+  char name[DIRSIZ];
+  char pad[14];
+};
+
+#define NDIRSIZE      32
+
+// A directory whose dinode has D_INDEXED set in major is hashed:
+// block 0 holds ".", "..", then (in the name bytes of entries with
+// inum 0) the index depth, DXMAGIC and a table of 2^depth leaf block
+// numbers. The entry for a name lives in leaf block
+// table[hash & (2^depth-1)], or anywhere in the directory if that
+// table slot has DXOVER set. Every block is still an array of
+// dirents, so such a directory can be read like a flat one. A kernel
+// that does not know the index puts the first entry it adds on top
+// of the index header, so a header whose entry is in use or lacks
+// DXMAGIC means the directory must be read as a flat one.
+#define D_INDEXED     0x1
+#define DXMAGIC       0xd1
+#define DXOVER        0x8000
+
+// A regular file whose dinode has D_EXTENTS set in major maps its
+// data as runs of consecutive blocks instead of through indirect
+// blocks: addrs[2*i] is the first block of run i and addrs[2*i+1]
+// its length, for NDEXTENT runs in the dinode and NIEXTENT more,
+// stored the same way, in block addrs[NDIRECT+1]. A run of length
+// zero ends the list.
+#define D_EXTENTS     0x2
+#define NDEXTENT      ((NDIRECT+1)/2)
+#define NIEXTENT      (BSIZE / (2*sizeof(uint)))
+// Blocks in the largest file that may be extent-mapped on disk;
+// the kernel switches a file to the block map before it grows
+// past this (see ebmap in fs.c).
+#define EXTMAX        (NDIRECT + 2*NINDIRECT - LOGSIZE)
+
 #endif
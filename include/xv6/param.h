@@ -1,13 +1,15 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          1  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // open files per process before its table grows
+#define NOFILEMAX  1024  // open files per process, at most a page of pointers
+#define NVMA          8  // mmap() regions per process
+#define NFILE       100  // open files per system before more are kalloc'd
+#define NINODE       50  // initial size of the i-node cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data sectors in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*12) // max blocks of on-disk log the kernel uses
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*2)  // size of disk block cache
 
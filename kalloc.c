@@ -20,6 +20,7 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  uchar ref[PHYSTOP/PGSIZE];  // mappings of each allocated page
 } kmem;
 
 // Initialization happens in two phases.
@@ -51,10 +52,11 @@ freerange(void *vstart, void *vend)
     kfree((char*)p);
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(char *v)
 {
@@ -67,6 +69,13 @@ kfree(char *v)
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
+  if(kmem.ref[v2p(v)/PGSIZE] > 1){
+    kmem.ref[v2p(v)/PGSIZE]--;
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  kmem.ref[v2p(v)/PGSIZE] = 0;
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
@@ -85,8 +94,10 @@ kalloc(void)
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    kmem.ref[v2p(r)/PGSIZE] = 1;
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
   return (char*)r;
@@ -112,8 +123,25 @@ kalloc_with_color(int col)
       kmem.freelist = r->next;
     else
       edge->next = r->next;
+    kmem.ref[v2p(r)/PGSIZE] = 1;
   }
   if(kmem.use_lock)
     release(&kmem.lock);
   return (char*)r;
 }
+
+// Add a reference to the allocated page v, for sharing it
+// between page tables. kfree() drops one.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || v2p(v) >= PHYSTOP)
+    panic("kref");
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(kmem.ref[v2p(v)/PGSIZE] == 0 || kmem.ref[v2p(v)/PGSIZE] == 255)
+    panic("kref: count");
+  kmem.ref[v2p(v)/PGSIZE]++;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
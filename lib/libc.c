@@ -12,6 +12,8 @@
 #include <unistd.h>
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define max(m, n)   ((m) > (n) ? (m) : (n))
 #define min(m, n)   ((m) < (n) ? (m) : (n))
@@ -104,11 +106,10 @@ FILE *fopen(const char *name, const char *mode)
     return NULL;
 
   if (*mode == 'w')
-    fd = open(name, O_CREATE | O_WRONLY);
-  else if (*mode == 'a') {
-    if ((fd = open(name, O_WRONLY)) == -1)
-      fd = open(name, O_WRONLY);
-  } else
+    fd = open(name, O_CREATE | O_WRONLY | O_TRUNC);
+  else if (*mode == 'a')
+    fd = open(name, O_CREATE | O_WRONLY | O_APPEND);
+  else
     fd = open(name, O_RDONLY);
 
   if (fd == -1)   /* couldn't access name */
@@ -131,6 +132,41 @@ int fclose(FILE *fp) {
 }
 
 
+/* Bytes buffered in fp but not yet read by the caller
+ * (negative) or written to the file (positive). */
+static int _buffered(FILE *fp)
+{
+  if (fp->flag & _READ)
+    return -fp->cnt;
+  if (fp->base != NULL)
+    return (int)(fp->ptr - fp->base);
+  return 0;
+}
+
+long ftell(FILE *fp)
+{
+  int off;
+
+  if ((off = lseek(fp->fd, 0, SEEK_CUR)) < 0)
+    return -1;
+  return off + _buffered(fp);
+}
+
+int fseek(FILE *fp, long off, int whence)
+{
+  if (fp->flag & _WRITE)
+    fflush(fp);
+  else if (whence == SEEK_CUR)
+    off -= fp->cnt;  /* read ahead of the caller */
+  if (lseek(fp->fd, off, whence) < 0)
+    return -1;
+  fp->cnt = 0;
+  fp->ptr = fp->base;
+  fp->flag &= ~_EOF;
+  return 0;
+}
+
+
 int _fillbuf(FILE *fp) {
   int bufsize;
 
@@ -254,8 +290,42 @@ int fgetc(FILE *fp)
 
 }
 
+/* Write out the buffer of fp followed by s[0..n-1] with one
+ * writev(), for data that does not fit in the buffer. */
+static int _flushtail(FILE *fp, const char *s, int n)
+{
+  struct iovec iov[2];
+  int len, r;
+
+  iov[0].iov_base = fp->base;
+  iov[0].iov_len = fp->ptr - fp->base;
+  iov[1].iov_base = (void *) s;
+  iov[1].iov_len = n;
+  len = iov[0].iov_len + n;
+  r = writev(fp->fd, iov, 2);
+  fp->ptr = fp->base;
+  fp->cnt = BUFSIZ - 1;
+  if (r != len) {
+    fp->flag |= _ERR;
+    return EOF;
+  }
+  return 0;
+}
+
 int fputs(char *s, FILE *stream)
 {
+  int n;
+
+  if ((stream->flag & (_WRITE|_UNBUF|_EOF|_ERR)) == _WRITE && stream->base) {
+    n = strlen(s);
+    if (n > stream->cnt ||
+        ((stream->flag & _LNBUF) && strchr(s, '\n') != NULL))
+      return _flushtail(stream, s, n) == EOF ? EOF : 1;
+    memcpy(stream->ptr, s, n);
+    stream->ptr += n;
+    stream->cnt -= n;
+    return 1;
+  }
 
   while(*s != '\0') {
 
@@ -19,30 +19,54 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// The size of the log comes from the superblock (see mkfs),
+// capped at LOGSIZE. Each outstanding operation reserves
+// log.opblocks blocks, an equal share of the log for LOGOPS
+// concurrent operations; filewrite() sizes its transactions
+// from the same figure via log_writeblocks().
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing sector #s for block A, B, C, ...
+//   header block, containing block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Committed transactions are not installed right away. Each
+// commit appends its blocks after those of earlier ones and
+// rewrites the header to cover them all, while the blocks stay
+// pinned in the buffer cache. Only when the log cannot take
+// another op does commit() checkpoint: it writes every logged
+// block to its home location once, however many transactions
+// touched it, and empties the log. A block may appear more than
+// once in the header; recovery replays them in order, so the
+// latest copy wins.
 
 // Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged sector #s before commit.
+// and to keep track in memory of logged block #s before commit.
 struct logheader {
   int n;
-  int sector[LOGSIZE];
+  int block[LOGSIZE];
 };
 
+#define LOGOPS 3  // # of FS ops the log admits at once
+
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // blocks in the log, including the header
+  int opblocks;    // log blocks reserved by each FS op
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
   int dev;
   struct logheader lh;
+  int committed;   // lh.block[0..committed-1] are committed
+
+  // For tuning the log size.
+  uint nwrite;     // log_write() calls
+  uint nabsorb;    // of which hit a block already in the transaction
 };
 struct log log;
 
@@ -62,22 +86,41 @@ initlog(void)
   readsb(ROOTDEV, &sb);
   log.start = sb.size - sb.nlog;
   log.size = sb.nlog;
+  if(log.size > LOGSIZE)
+    log.size = LOGSIZE;  // the rest of the on-disk log goes unused
+  if(log.size - 1 < MAXOPBLOCKS)
+    panic("initlog: log too small");
+  log.opblocks = (log.size - 1) / LOGOPS;
+  if(log.opblocks < MAXOPBLOCKS)
+    log.opblocks = MAXOPBLOCKS;
   log.dev = ROOTDEV;
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks to their home location.
+// Until then the blocks stay pinned (B_DIRTY) in the buffer
+// cache, so just write them back; only recovery has to fetch
+// them from the log.
 static void
-install_trans(void)
+install_trans(int recovering)
 {
   int tail;
+  struct buf *lbuf, *dbuf;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.sector[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+    if (recovering) {
+      lbuf = bread(log.dev, log.start+tail+1); // read log block
+      dbuf = bgetnew(log.dev, log.lh.block[tail]); // overwritten
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    } else {
+      dbuf = bread(log.dev, log.lh.block[tail]); // cached, no I/O
+      if (!(dbuf->flags & B_DIRTY)) {  // logged twice, already written
+        brelse(dbuf);
+        continue;
+      }
+    }
     bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
     brelse(dbuf);
   }
 }
@@ -91,7 +134,7 @@ read_head(void)
   int i;
   log.lh.n = lh->n;
   for (i = 0; i < log.lh.n; i++) {
-    log.lh.sector[i] = lh->sector[i];
+    log.lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
@@ -107,7 +150,7 @@ write_head(void)
   int i;
   hb->n = log.lh.n;
   for (i = 0; i < log.lh.n; i++) {
-    hb->sector[i] = log.lh.sector[i];
+    hb->block[i] = log.lh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,7 +160,7 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
+  install_trans(1); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
 }
@@ -130,7 +173,7 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*log.opblocks > log.size - 1){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
@@ -141,6 +184,24 @@ begin_op(void)
   }
 }
 
+// Number of file data blocks one FS system call may write,
+// leaving room in its share of the log for the i-node, up to
+// three indirect blocks, two bitmap blocks, and 2 blocks of
+// slop for non-aligned writes.
+int
+log_writeblocks(void)
+{
+  return log.opblocks-1-3-2-2;
+}
+
+// Print the log_write() counters to console, for tuning the
+// log size. Runs from procdump(), so takes no lock.
+void
+logdump(void)
+{
+  cprintf("log: %d writes, %d absorbed\n", log.nwrite, log.nabsorb);
+}
+
 // called at the end of each FS system call.
 // commits if this was the last outstanding operation.
 void
@@ -178,10 +239,11 @@ write_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.sector[tail]); // cache block
+  for (tail = log.committed; tail < log.lh.n; tail++) {
+    struct buf *to = bgetnew(log.dev, log.start+tail+1); // log block
+    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
+    from->flags &= ~B_LOGGED;  // later writes start a new transaction
     bwrite(to);  // write the log
     brelse(from);
     brelse(to);
@@ -191,18 +253,24 @@ write_log(void)
 static void
 commit()
 {
-  if (log.lh.n > 0) {
+  if (log.lh.n > log.committed) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.committed = log.lh.n;
+  }
+  if (log.lh.n + log.opblocks > log.size - 1) {
+    // No room for another op; checkpoint.
+    install_trans(0); // Now install writes to home locations
+    log.lh.n = log.committed = 0;
+    write_head();    // Erase the transactions from the log
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
 // commit()/write_log() will do the disk write.
+// B_LOGGED marks blocks already in the transaction, so a
+// block written again is absorbed without searching the log.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -212,19 +280,16 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
-
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.sector[i] == b->sector)   // log absorbtion
-      break;
+  log.nwrite++;
+  if (b->flags & B_LOGGED) {   // log absorbtion
+    log.nabsorb++;
+    return;
   }
-  log.lh.sector[i] = b->sector;
-  if (i == log.lh.n)
-    log.lh.n++;
-  b->flags |= B_DIRTY; // prevent eviction
+  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+    panic("too big a transaction");
+  log.lh.block[log.lh.n++] = b->blockno;
+  b->flags |= B_DIRTY | B_LOGGED; // prevent eviction
 }
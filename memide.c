@@ -3,6 +3,7 @@
 
 #include <sys/types.h>
 #include <xv6/param.h>
+#include <xv6/fs.h>
 #include "defs.h"
 #include "mmu.h"
 #include "proc.h"
@@ -13,14 +14,14 @@
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
-static int disksize;
+static int disksize;  // in sectors
 static uchar *memdisk;
 
 void
 ideinit(void)
 {
   memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/512;
+  disksize = (uint)_binary_fs_img_size/SECTSIZE;
 }
 
 // Interrupt handler.
@@ -30,7 +31,7 @@ ideintr(void)
   // no-op
 }
 
-// Sync buf with disk.
+// Sync buf with disk; a block is BSIZE/SECTSIZE consecutive sectors.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void
@@ -44,15 +45,15 @@ iderw(struct buf *b)
     panic("iderw: nothing to do");
   if(b->dev != 1)
     panic("iderw: request not for disk 1");
-  if(b->sector >= disksize)
-    panic("iderw: sector out of range");
+  if((b->blockno+1)*(BSIZE/SECTSIZE) > disksize)
+    panic("iderw: block out of range");
 
-  p = ((uint)memdisk) + b->sector*512;
+  p = ((uint)memdisk) + b->blockno*BSIZE;
 
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
-    memmove((char*)p, b->data, 512);
+    memmove((char*)p, b->data, BSIZE);
   } else
-    memmove(b->data, (char*)p, 512);
+    memmove(b->data, (char*)p, BSIZE);
   b->flags |= B_VALID;
 }
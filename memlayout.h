@@ -7,6 +7,7 @@
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
+#define MMAPBASE 0x40000000         // mmap() regions live in [MMAPBASE, KERNBASE)
 
 // [0x80000000, 0x80001FFF] is special memory mapped area.
 // Kernel MUST guarantee that this memory area is directly mapped to the physical same area.
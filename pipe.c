@@ -2,22 +2,41 @@
 #include <sys/file.h>
 #include <xv6/param.h>
 #include <xv6/fs.h>
+#include <poll.h>
 #include "defs.h"
 #include "mmu.h"
+#include "memlayout.h"
 #include "proc.h"
 #include "spinlock.h"
 
-#define PIPESIZE 512
+// A pipe is a ring buffer filling the rest of its kalloc page.
+#define PIPESIZE (PGSIZE - 128)
+
+// Writes of at least PIPEDIRECT bytes from user memory skip the
+// ring: the writer posts its buffer in the pipe and sleeps, and
+// readers copy straight out of the writer's memory.
+#define PIPEDIRECT PGSIZE
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
-  uint nread;     // number of bytes read
-  uint nwrite;    // number of bytes written
+  uint nread;     // offset in data of the next byte to read
+  uint nwrite;    // offset in data of the next byte to write
+  uint count;     // number of bytes in data
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  pde_t *dpgdir;  // page table of the direct writer
+  uint daddr;     // its user address of the next byte to read
+  uint dcount;    // bytes of the direct write left; 0 if none
+  int dfault;     // a reader could not copy from the direct writer
+  char data[PIPESIZE];
 };
 
+static int pipewritedirect(struct pipe*, char*, int);
+static void pipewakeup(void*);
+static void ringput(struct pipe*, char*, int);
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -27,21 +46,28 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
+  if(sizeof(struct pipe) > PGSIZE)
+    panic("pipealloc: struct pipe too big");
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->count = 0;
+  p->dcount = 0;
+  p->dfault = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
   (*f0)->pipe = p;
+  (*f0)->flags = 0;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
   (*f1)->pipe = p;
+  (*f1)->flags = 0;
   return 0;
 
  bad:
@@ -60,10 +86,10 @@ pipeclose(struct pipe *p, int writable)
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
-    wakeup(&p->nread);
+    pipewakeup(&p->nread);
   } else {
     p->readopen = 0;
-    wakeup(&p->nwrite);
+    pipewakeup(&p->nwrite);
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
@@ -72,47 +98,222 @@ pipeclose(struct pipe *p, int writable)
     release(&p->lock);
 }
 
+// Wake the sleepers on chan, and poll() since the pipe
+// changed state.
+static void
+pipewakeup(void *chan)
+{
+  wakeup(chan);
+  pollwakeup();
+}
+
+// Readers sleep on &p->nread while the pipe is empty and writers
+// on &p->nwrite while it is full, so each side wakes the other only
+// when it ends that state. A direct write counts as full for other
+// writers until it has been read.
+// A nonblocking write takes what fits and fails if nothing does.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int i, m;
 
+  if(nonblock){
+    m = pipeput(p, addr, n);
+    return m == 0 && n > 0 ? -1 : m;
+  }
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  if(n >= PIPEDIRECT && (uint)addr < KERNBASE)
+    return pipewritedirect(p, addr, n);
+  for(i = 0; i < n; i += m){
+    while(p->count == PIPESIZE || p->dcount > 0){  //DOC: pipewrite-full
       if(p->readopen == 0 || proc->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = min(n - i, (int)(PIPESIZE - p->count));
+    ringput(p, addr + i, m);
+  }
+  release(&p->lock);
+  return n;
+}
+
+// Append m bytes, which must fit, to the ring.
+// Caller holds p->lock.
+static void
+ringput(struct pipe *p, char *addr, int m)
+{
+  int k;
+
+  if(m > 0 && p->count == 0)
+    pipewakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  k = min(m, PIPESIZE - p->nwrite);
+  memmove(p->data + p->nwrite, addr, k);
+  memmove(p->data, addr + k, m - k);
+  p->nwrite += m;
+  if(p->nwrite >= PIPESIZE)
+    p->nwrite -= PIPESIZE;
+  p->count += m;
+}
+
+// Write as much of addr[0..n-1] as fits without sleeping.
+// Return the number of bytes written, or -1 if there is no
+// reader. For callers that hold a buffer and must not sleep.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  int m;
+
+  acquire(&p->lock);
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  m = 0;
+  if(p->dcount == 0){
+    m = n > 0 ? min(n, (int)(PIPESIZE - p->count)) : 0;
+    ringput(p, addr, m);
+  }
+  release(&p->lock);
+  return m;
+}
+
+// Wait until p has room for pipeput().
+// Return -1 if there is no reader or the caller was killed.
+int
+pipewait(struct pipe *p)
+{
+  acquire(&p->lock);
+  while(p->count == PIPESIZE || p->dcount > 0){
+    if(p->readopen == 0 || proc->killed){
+      release(&p->lock);
+      return -1;
+    }
+    sleep(&p->nwrite, &p->lock);
+  }
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// Return how many bytes pipeput() would take right now, 0 if
+// p is full or has no reader.
+int
+piperoom(struct pipe *p)
+{
+  int r;
+
+  acquire(&p->lock);
+  r = 0;
+  if(p->readopen && p->dcount == 0)
+    r = PIPESIZE - p->count;
+  release(&p->lock);
+  return r;
+}
+
+// Post addr[0..n-1] for readers to copy and wait until they have.
+// Bytes already in the ring are read first. Called and returns
+// with p->lock held, released.
+static int
+pipewritedirect(struct pipe *p, char *addr, int n)
+{
+  while(p->dcount > 0){  // another direct write
+    if(p->readopen == 0 || proc->killed){
+      release(&p->lock);
+      return -1;
+    }
+    sleep(&p->nwrite, &p->lock);
+  }
+  p->dpgdir = proc->pgdir;
+  p->daddr = (uint)addr;
+  p->dcount = n;
+  p->dfault = 0;
+  pipewakeup(&p->nread);
+  while(p->dcount > 0){
+    if(p->readopen == 0 || proc->killed){
+      p->dcount = 0;  // withdraw the rest
+      pipewakeup(&p->nwrite);
+      release(&p->lock);
+      return -1;
+    }
+    sleep(&p->nwrite, &p->lock);
+  }
+  if(p->dfault){
+    release(&p->lock);
+    return -1;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
 int
-piperead(struct pipe *p, char *addr, int n)
+piperead(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int m, k;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-    if(proc->killed){
+  while(p->count == 0 && p->dcount == 0 && p->writeopen){  //DOC: pipe-empty
+    if(nonblock || proc->killed){
       release(&p->lock);
       return -1;
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  if(p->count == 0 && p->dcount > 0){
+    m = n > 0 ? min(n, (int)p->dcount) : 0;
+    if(copyin(p->dpgdir, addr, p->daddr, m) < 0){
+      // Part of the writer's buffer is not mapped: fail both.
+      p->dcount = 0;
+      p->dfault = 1;
+      pipewakeup(&p->nwrite);
+      release(&p->lock);
+      return -1;
+    }
+    p->daddr += m;
+    p->dcount -= m;
+    if(p->dcount == 0)
+      pipewakeup(&p->nwrite);
+    release(&p->lock);
+    return m;
+  }
+  m = n > 0 ? min(n, (int)p->count) : 0;  //DOC: piperead-copy
+  if(m > 0 && p->count == PIPESIZE)
+    pipewakeup(&p->nwrite);  //DOC: piperead-wakeup
+  k = min(m, PIPESIZE - p->nread);
+  memmove(addr, p->data + p->nread, k);
+  memmove(addr + k, p->data, m - k);
+  p->nread += m;
+  if(p->nread >= PIPESIZE)
+    p->nread -= PIPESIZE;
+  p->count -= m;
+  release(&p->lock);
+  return m;
+}
+
+// Return the POLL* events ready on the read end of p or, if
+// writable, on its write end.
+int
+pipepoll(struct pipe *p, int writable)
+{
+  int r;
+
+  acquire(&p->lock);
+  r = 0;
+  if(writable){
+    if(p->readopen == 0)
+      r = POLLERR;
+    else if(p->count < PIPESIZE && p->dcount == 0)
+      r = POLLOUT;
+  } else {
+    if(p->count > 0 || p->dcount > 0)
+      r = POLLIN;
+    if(p->writeopen == 0)
+      r |= POLLHUP;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
-  return i;
+  return r;
 }
@@ -70,6 +70,11 @@ found:
   p->context = (struct context*)sp;
   memset(p->context, 0, sizeof *p->context);
   p->context->r28 = (uint)forkret;
+  memset(p->vma, 0, sizeof(p->vma));
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
+  memset(p->ofile0, 0, sizeof(p->ofile0));
+  memset(p->fdmap, 0, sizeof(p->fdmap));
 
   return p;
 }
@@ -120,6 +125,66 @@ growproc(int n)
   return 0;
 }
 
+// Switch p from ofile0 to a full page of NOFILEMAX descriptors.
+static int
+fdgrow(struct proc *p)
+{
+  struct file **ofile;
+
+  if(NOFILEMAX*sizeof(struct file*) > PGSIZE)
+    panic("fdgrow: NOFILEMAX");
+  if(p->ofile != p->ofile0 || (ofile = (struct file**)kalloc()) == 0)
+    return -1;
+  memset(ofile, 0, PGSIZE);
+  memmove(ofile, p->ofile0, sizeof(p->ofile0));
+  memset(p->ofile0, 0, sizeof(p->ofile0));
+  p->ofile = ofile;
+  p->nofile = NOFILEMAX;
+  return 0;
+}
+
+// Release the page fdgrow() gave p, if any. Its files
+// must already be closed.
+static void
+fdshrink(struct proc *p)
+{
+  if(p->ofile != p->ofile0)
+    kfree((char*)p->ofile);
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
+}
+
+// Allocate the lowest free file descriptor for the given file.
+// Takes over file reference from caller on success.
+int
+fdalloc(struct file *f)
+{
+  uint w;
+  int i, fd;
+
+  for(i = 0; i < NOFILEMAX/32; i++)
+    if(proc->fdmap[i] != 0xffffffff)
+      break;
+  if(i == NOFILEMAX/32)
+    return -1;
+  fd = i*32;
+  for(w = proc->fdmap[i]; w & 1; w >>= 1)
+    fd++;
+  if(fd >= proc->nofile && fdgrow(proc) < 0)
+    return -1;
+  proc->fdmap[i] |= (uint)1 << (fd%32);
+  proc->ofile[fd] = f;
+  return fd;
+}
+
+// Clear file descriptor fd; the caller closes its file.
+void
+fdfree(int fd)
+{
+  proc->ofile[fd] = 0;
+  proc->fdmap[fd/32] &= ~((uint)1 << (fd%32));
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -135,22 +200,33 @@ fork(void)
     return -1;
 
   // Copy process state from p.
-  if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
+  np->pgdir = copyuvm(proc->pgdir, proc->sz);
+  if(np->pgdir && copyvma(np->pgdir, proc) < 0){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+  }
+  if(np->pgdir && proc->nofile > np->nofile && fdgrow(np) < 0){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+  }
+  if(np->pgdir == 0){
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
   np->sz = proc->sz;
+  memmove(np->vma, proc->vma, sizeof(proc->vma));
   np->parent = proc;
   memcpy(np->tf, proc->tf, sizeof(*np->tf));
 
   // Clear r1 so that fork returns 0 in the child.
   np->tf->r1 = 0;
 
-  for(i = 0; i < NOFILE; i++)
+  for(i = 0; i < proc->nofile; i++)
     if(proc->ofile[i])
       np->ofile[i] = filedup(proc->ofile[i]);
+  memmove(np->fdmap, proc->fdmap, sizeof(proc->fdmap));
   np->cwd = idup(proc->cwd);
 
   safestrcpy(np->name, proc->name, sizeof(proc->name));
@@ -178,12 +254,13 @@ exit(void)
     panic("init exiting");
 
   // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
+  for(fd = 0; fd < proc->nofile; fd++){
     if(proc->ofile[fd]){
       fileclose(proc->ofile[fd]);
-      proc->ofile[fd] = 0;
+      fdfree(fd);
     }
   }
+  fdshrink(proc);
 
   begin_op();
   iput(proc->cwd);
@@ -332,7 +409,7 @@ forkret(void)
     // of a regular process (e.g., they call sleep), and thus cannot
     // be run from main().
     first = 0;
-    initlog();
+    fsinit(ROOTDEV);
   }
 
 
@@ -429,7 +506,8 @@ kill(int pid)
   return -1;
 }
 
-// Print a process listing to console.  For debugging.
+// Print a process listing and the log counters to console.
+// For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
 void
@@ -465,4 +543,5 @@ procdump(void)
     }
     cprintf("\n");
   }
+  logdump();
 }
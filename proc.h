@@ -38,6 +38,14 @@ struct context {
   uint rbp;
 };
 
+// A region of the address space mapped by mmap()
+struct vma {
+  uint addr;                   // Start, page-aligned; unused if len is 0
+  uint len;                    // Size in bytes, a multiple of PGSIZE
+  int prot;                    // PROT_ bits
+  int flags;                   // MAP_ bits
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -52,7 +60,11 @@ struct proc {
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files, ofile0 or a kalloc'd page
+  int nofile;                  // Number of slots in ofile
+  uint fdmap[NOFILEMAX/32];    // Bitmap of fds in use
+  struct file *ofile0[NOFILE]; // Initial open file table
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct vma vma[NVMA];        // mmap() regions
 };
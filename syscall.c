@@ -58,7 +58,8 @@ argptr(int n, char **pp, int size)
 
   if(argint(n, &i) < 0)
     return -1;
-  if((uint)i >= proc->sz || (uint)i+size > proc->sz)
+  if(((uint)i >= proc->sz || (uint)i+size > proc->sz) &&
+     !mapped(proc, i, size))
     return -1;
   *pp = (char*)i;
   return 0;
@@ -66,8 +67,9 @@ argptr(int n, char **pp, int size)
 
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (fetchstr only accepts addresses below proc->sz, and MAP_SHARED
+// memory lives above MMAPBASE, so no other process can change the
+// string between this check and being used by the kernel.)
 int
 argstr(int n, char **pp)
 {
@@ -101,6 +103,18 @@ extern int sys_uptime(void);
 extern int sys_halt(void);
 extern int sys_ioctl(void);
 extern int sys_procdump(void);
+extern int sys_getdents(void);
+extern int sys_sendfile(void);
+extern int sys_lseek(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_poll(void);
+extern int sys_fcntl(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_ftruncate(void);
 
 int callsys (int num) {
   switch(num){
@@ -128,6 +142,18 @@ int callsys (int num) {
   case SYS_halt   : return sys_halt();
   case SYS_ioctl  : return sys_ioctl();
   case SYS_procdump : return sys_procdump();
+  case SYS_getdents : return sys_getdents();
+  case SYS_sendfile : return sys_sendfile();
+  case SYS_lseek  : return sys_lseek();
+  case SYS_pread  : return sys_pread();
+  case SYS_pwrite : return sys_pwrite();
+  case SYS_readv  : return sys_readv();
+  case SYS_writev : return sys_writev();
+  case SYS_poll   : return sys_poll();
+  case SYS_fcntl  : return sys_fcntl();
+  case SYS_mmap   : return sys_mmap();
+  case SYS_munmap : return sys_munmap();
+  case SYS_ftruncate : return sys_ftruncate();
   default         : return -1;
   }
 }
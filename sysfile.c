@@ -7,6 +7,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <xv6/param.h>
 #include <xv6/fs.h>
@@ -24,7 +27,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=proc->ofile[fd]) == 0)
+  if(fd < 0 || fd >= proc->nofile || (f=proc->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -33,22 +36,6 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-  int fd;
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(proc->ofile[fd] == 0){
-      proc->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
-}
-
 int
 sys_dup(void)
 {
@@ -87,6 +74,174 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the iovec array of a readv() or writev() call into iov
+// and check that each buffer lies in user memory.
+static int
+argiov(struct iovec *iov, int *pcnt)
+{
+  struct iovec *uiov;
+  uint base, len;
+  int i, cnt;
+
+  if(argint(2, &cnt) < 0 || cnt < 0 || cnt > IOV_MAX ||
+     argptr(1, (void*)&uiov, cnt*sizeof(*uiov)) < 0)
+    return -1;
+  for(i = 0; i < cnt; i++){
+    base = (uint)uiov[i].iov_base;
+    len = uiov[i].iov_len;
+    if((base > proc->sz || base+len > proc->sz || base+len < base) &&
+       !mapped(proc, base, len))
+      return -1;
+    iov[i].iov_base = uiov[i].iov_base;
+    iov[i].iov_len = len;
+  }
+  *pcnt = cnt;
+  return 0;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &cnt) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  if(cmd == F_GETFL){
+    if(f->readable && f->writable)
+      return O_RDWR | f->flags;
+    return (f->writable ? O_WRONLY : O_RDONLY) | f->flags;
+  }
+  if(cmd == F_SETFL){
+    f->flags = arg & (O_NONBLOCK|O_APPEND);
+    return 0;
+  }
+  return -1;
+}
+
+// Check each of nfds files until one is ready, sleeping in
+// between; timeout counts clock ticks, and is infinite if negative.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  struct file *f;
+  int i, n, nfds, timeout;
+  uint gen, ticks0;
+
+  if(argint(1, &nfds) < 0 || nfds < 0 || nfds > NOFILEMAX ||
+     argptr(0, (void*)&fds, nfds*sizeof(*fds)) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  acquire(&tickslock);
+  ticks0 = ticks;
+  release(&tickslock);
+  for(;;){
+    gen = pollgen();
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(fds[i].fd >= proc->nofile || (f = proc->ofile[fds[i].fd]) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f, fds[i].events);
+      if(fds[i].revents)
+        n++;
+    }
+    if(n > 0 || timeout == 0)
+      return n;
+    if(proc->killed)
+      return -1;
+    if(timeout > 0 && ticks - ticks0 >= timeout)
+      return 0;
+    pollsleep(gen, timeout > 0);
+  }
+}
+
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+int
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+int
+sys_ftruncate(void)
+{
+  struct file *f;
+  int len;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &len) < 0 || len < 0)
+    return -1;
+  return filetruncate(f, len);
+}
+
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesendfile(out, in, n);
+}
+
 int
 sys_close(void)
 {
@@ -95,11 +250,28 @@ sys_close(void)
   
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  proc->ofile[fd] = 0;
+  fdfree(fd);
   fileclose(f);
   return 0;
 }
 
+int
+sys_getdents(void)
+{
+  struct file *f;
+  struct dirstat *ds;
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || n < 0)
+    return -1;
+  // Keep n*sizeof(*ds) from wrapping; callers loop anyway.
+  if(n > PGSIZE/sizeof(*ds))
+    n = PGSIZE/sizeof(*ds);
+  if(argptr(1, (void*)&ds, n*sizeof(*ds)) < 0)
+    return -1;
+  return filegetdents(f, ds, n);
+}
+
 int
 sys_fstat(void)
 {
@@ -165,17 +337,17 @@ bad:
 static int
 isdirempty(struct inode *dp)
 {
-  int off;
   struct dirent de;
-  char xde[XDIRSIZE];
+  struct diriter it;
 
-  for(off=2*sizeof(xde); off<dp->size; off+=sizeof(xde)){
-    if(readi(dp, xde, off, sizeof(xde)) != sizeof(xde))
-      panic("isdirempty: readi");
-    xdirent2gaia(xde, &de);
-    if(de.inum != 0)
+  diropen(&it, dp);
+  while(dirnext(&it, &de)){
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0){
+      dirclose(&it);
       return 0;
+    }
   }
+  dirclose(&it);
   return 1;
 }
 
@@ -183,7 +355,6 @@ int
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  char xde[XDIRSIZE];
   char name[DIRSIZ], *path;
   uint off;
 
@@ -213,9 +384,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(xde, 0, sizeof(xde));
-  if(writei(dp, xde, off, sizeof(xde)) != sizeof(xde))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -260,8 +429,10 @@ create(char *path, short type, short major, short minor)
     panic("create: ialloc");
 
   ilock(ip);
-  ip->major = major;
-  ip->minor = minor;
+  if(type == T_DEV){  // otherwise major holds D_* flags set by ialloc
+    ip->major = major;
+    ip->minor = minor;
+  }
   ip->nlink = 1;
   iupdate(ip);
 
@@ -320,6 +491,8 @@ sys_open(void)
     end_op();
     return -1;
   }
+  if((omode & O_TRUNC) && ip->type == T_FILE && (omode & (O_WRONLY|O_RDWR)))
+    itrunc(ip, 0);
   iunlock(ip);
   end_op();
 
@@ -328,6 +501,7 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->flags = omode & (O_NONBLOCK|O_APPEND);
   return fd;
 }
 
@@ -439,7 +613,7 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      proc->ofile[fd0] = 0;
+      fdfree(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -465,3 +639,39 @@ sys_ioctl(void)
     return -1;
   return devsw[f->ip->major].ioctl(f->ip, request);
 }
+
+// Map part of a regular file, or zeroed memory with MAP_ANON.
+// File mappings must be private: the pages are copies, so writes
+// never reach the file. Anonymous memory may also be MAP_SHARED,
+// in which case fork children share its pages.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int len, prot, flags, off;
+  uint a;
+
+  if(argint(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || off % PGSIZE)
+    return -1;
+  if(flags == (MAP_ANON|MAP_PRIVATE) || flags == (MAP_ANON|MAP_SHARED))
+    a = mmapuvm(proc, 0, 0, len, prot, flags);
+  else if(flags == MAP_PRIVATE){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    ilock(f->ip);
+    if(f->ip->type != T_FILE){
+      iunlock(f->ip);
+      return -1;
+    }
+    a = mmapuvm(proc, f->ip, off, len, prot, flags);
+    iunlock(f->ip);
+  } else
+    return -1;
+  if(a == 0)
+    return -1;
+  switchuvm(proc);
+  return a;
+}
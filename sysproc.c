@@ -55,6 +55,19 @@ sys_sbrk(void)
   return addr;
 }
 
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  if(munmapuvm(proc, addr, len) < 0)
+    return -1;
+  switchuvm(proc);
+  return 0;
+}
+
 int
 sys_sleep(void)
 {
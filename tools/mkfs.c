@@ -13,14 +13,18 @@
 
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 
-int nblocks = (995-LOGSIZE);
-int nlog = LOGSIZE;
+int nblocks;
+int nlog = LOGSIZE*512/BSIZE;  // same bytes whatever BSIZE; the kernel copes with a short log
 int ninodes = 200;
-int size = 1024;
+int size = 1024*512/BSIZE;  // likewise, so the image fits where kernelmemfs puts it
+int native;        // -n: write struct ndinode/ndirent (SB_NATIVE)
+int extents;       // -e: extent-mapped files (SB_EXTENTS)
+uint ipb = IPB;
+uint desize = sizeof(struct dirent);
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
+char zeroes[BSIZE];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
@@ -33,6 +37,12 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void wdir(uint inum, struct dirent *de, int n);
+uint eblock(struct dinode *din, uint fbn);
+
+#define NROOT 1024
+struct dirent root[NROOT];
+int nroot;
 
 // convert to intel byte order
 ushort
@@ -62,20 +72,31 @@ main(int argc, char *argv[])
 {
   int i, cc, fd;
   uint rootino, inum, off;
-  struct dirent de;
-  char buf[512];
+  char buf[BSIZE];
   struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  for(; argc > 1 && argv[1][0] == '-'; argc--, argv++){
+    if(strcmp(argv[1], "-n") == 0){
+      native = 1;
+      ipb = NIPB;
+      desize = NDIRSIZE;
+    } else if(strcmp(argv[1], "-e") == 0)
+      extents = 1;
+    else
+      break;
+  }
+  if(argc < 2 || argv[1][0] == '-'){
+    fprintf(stderr, "Usage: mkfs [-n] [-e] fs.img files...\n");
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct dirent)) == 0);
+  assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(sizeof(struct ndinode) == NDINSIZE);
+  assert(sizeof(struct ndirent) == NDIRSIZE);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -83,17 +104,20 @@ main(int argc, char *argv[])
     exit(1);
   }
 
+  bitblocks = size/BPB + 1;
+  usedblocks = ninodes / ipb + 3 + bitblocks;
+  freeblock = usedblocks;
+  nblocks = size - usedblocks - nlog;
+
   sb.size = xint(size);
   sb.nblocks = xint(nblocks); // so whole disk is size sectors
   sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
-
-  bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
-  freeblock = usedblocks;
+  sb.flags = xint((native ? SB_NATIVE : 0) | (extents ? SB_EXTENTS : 0));
+  sb.bsize = xint(BSIZE);
 
   printf("used %d (bit %d ninode %u) free %u log %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock, nlog, nblocks+usedblocks+nlog);
+         bitblocks, ninodes/ipb + 1, freeblock, nlog, nblocks+usedblocks+nlog);
 
   assert(nblocks + usedblocks + nlog == size);
 
@@ -107,15 +131,10 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  root[nroot].inum = xshort(rootino);
+  strcpy(root[nroot++].name, ".");
+  root[nroot].inum = xshort(rootino);
+  strcpy(root[nroot++].name, "..");
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -133,22 +152,32 @@ main(int argc, char *argv[])
       ++argv[i];
 
     inum = ialloc(T_FILE);
+    // Larger files would be too big for the kernel to switch
+    // to the block map; see ebmap() in fs.c.
+    if(extents && lseek(fd, 0, SEEK_END) <= EXTMAX*BSIZE){
+      rinode(inum, &din);
+      din.major = xshort(D_EXTENTS);
+      winode(inum, &din);
+    }
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nroot < NROOT);
+    root[nroot].inum = xshort(inum);
+    strncpy(root[nroot++].name, argv[i], DIRSIZ);
 
+    lseek(fd, 0, SEEK_SET);
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
 
     close(fd);
   }
 
+  wdir(rootino, root, nroot);
+
   // fix size of root inode dir
   rinode(rootino, &din);
   off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
+  if(off % BSIZE)
+    off = ((off/BSIZE) + 1) * BSIZE;
   din.size = xint(off);
   winode(rootino, &din);
 
@@ -160,11 +189,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
@@ -173,44 +202,70 @@ wsect(uint sec, void *buf)
 uint
 i2b(uint inum)
 {
-  return (inum / IPB) + 2;
+  return (inum / ipb) + 2;
 }
 
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
+  struct ndinode *ndip;
+  int i;
 
   bn = i2b(inum);
   rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *dip = *ip;
+  if(native){
+    ndip = ((struct ndinode*)buf) + (inum % ipb);
+    ndip->type = xint(xshort(ip->type));
+    ndip->major = xint(xshort(ip->major));
+    ndip->minor = xint(xshort(ip->minor));
+    ndip->nlink = xint(xshort(ip->nlink));
+    ndip->size = ip->size;
+    for(i = 0; i < NDIRECT+2; i++)
+      ndip->addrs[i] = ip->addrs[i];
+  } else {
+    dip = ((struct dinode*)buf) + (inum % ipb);
+    *dip = *ip;
+  }
   wsect(bn, buf);
 }
 
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
+  struct ndinode *ndip;
+  int i;
 
   bn = i2b(inum);
   rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *ip = *dip;
+  if(native){
+    ndip = ((struct ndinode*)buf) + (inum % ipb);
+    ip->type = xshort(xint(ndip->type));
+    ip->major = xshort(xint(ndip->major));
+    ip->minor = xshort(xint(ndip->minor));
+    ip->nlink = xshort(xint(ndip->nlink));
+    ip->size = ndip->size;
+    for(i = 0; i < NDIRECT+2; i++)
+      ip->addrs[i] = ndip->addrs[i];
+  } else {
+    dip = ((struct dinode*)buf) + (inum % ipb);
+    *ip = *dip;
+  }
 }
 
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, BSIZE) != BSIZE){
     perror("read");
     exit(1);
   }
@@ -233,44 +288,75 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar buf[BSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
+  assert(used < BPB);
+  bzero(buf, BSIZE);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
-  printf("balloc: write bitmap block at sector %u\n", ninodes/IPB + 3);
-  wsect(ninodes / IPB + 3, buf);
+  printf("balloc: write bitmap block at sector %u\n", ninodes/ipb + 3);
+  wsect(ninodes / ipb + 3, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Block fbn of extent-mapped inode din, allocated if it is the
+// next block of the file. Files are written one after another,
+// so each one ends up as a single run.
+uint
+eblock(struct dinode *din, uint fbn)
+{
+  uint i, b, len;
+
+  b = 0;
+  for(i = 0; i < NDEXTENT; i++){
+    len = xint(din->addrs[2*i+1]);
+    if(len == 0)
+      break;
+    if(fbn < b + len)
+      return xint(din->addrs[2*i]) + fbn - b;
+    b += len;
+  }
+  assert(fbn == b);
+  if(i > 0 && xint(din->addrs[2*i-2]) + xint(din->addrs[2*i-1]) == freeblock){
+    din->addrs[2*i-1] = xint(xint(din->addrs[2*i-1]) + 1);
+  } else {
+    assert(i < NDEXTENT);
+    din->addrs[2*i] = xint(freeblock);
+    din->addrs[2*i+1] = xint(1);
+  }
+  usedblocks++;
+  return freeblock++;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[512];
+  char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, i;
 
   rinode(inum, &din);
 
   off = xint(din.size);
   while(n > 0){
-    fbn = off / 512;
+    fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
+    if(xshort(din.major) & D_EXTENTS){
+      x = eblock(&din, fbn);
+    } else if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
         usedblocks++;
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         // printf("allocate indirect block\n");
         din.addrs[NDIRECT] = xint(freeblock++);
@@ -284,10 +370,31 @@ iappend(uint inum, void *xp, int n)
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+        usedblocks++;
+      }
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      i = (fbn - NDIRECT - NINDIRECT) / NINDIRECT;
+      if(indirect[i] == 0){
+        indirect[i] = xint(freeblock++);
+        usedblocks++;
+        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      }
+      x = xint(indirect[i]);
+      rsect(x, (char*)indirect);
+      i = (fbn - NDIRECT - NINDIRECT) % NINDIRECT;
+      if(indirect[i] == 0){
+        indirect[i] = xint(freeblock++);
+        usedblocks++;
+        wsect(x, (char*)indirect);
+      }
+      x = xint(indirect[i]);
     }
-    n1 = min(n, (fbn + 1) * 512 - off);
+    n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
+    bcopy(p, buf + off - (fbn * BSIZE), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -296,3 +403,112 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Must match dirhash() in fs.c.
+uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261u;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+#define DIRPB (BSIZE / desize)
+#define DXSLOT 2
+#define DXMAXDEPTH 7
+
+// Store directory entry de at p in the on-disk layout.
+void
+putdirent(char *p, struct dirent *de)
+{
+  struct ndirent *nde;
+
+  if(native){
+    nde = (struct ndirent*)p;
+    bzero(nde, sizeof(*nde));
+    nde->inum = xint(xshort(de->inum));
+    memmove(nde->name, de->name, DIRSIZ);
+  } else
+    memmove(p, de, sizeof(*de));
+}
+
+// Byte i of the index area of block 0 of an indexed directory.
+uchar*
+dxbyte(char *buf, int i)
+{
+  return (uchar*)buf + (DXSLOT + i/DIRSIZ)*desize + (native ? 4 : 2) + i%DIRSIZ;
+}
+
+// Largest table depth that fits in block 0; as in fs.c.
+int
+dxmaxdepth(void)
+{
+  int depth;
+
+  depth = 0;
+  while(2 + 2*(2 << depth) <= (DIRPB - DXSLOT) * DIRSIZ)
+    depth++;
+  return depth;
+}
+
+// Write the n entries de (the first two "." and "..") into
+// directory inum, as an indexed directory (see fs.h) if they
+// do not fit in one block.
+void
+wdir(uint inum, struct dirent *de, int n)
+{
+  char buf[BSIZE];
+  int i, j, k, depth, max;
+  int count[1<<DXMAXDEPTH];
+  struct dinode din;
+
+  if(n <= DIRPB){
+    bzero(buf, sizeof(buf));
+    for(i = 0; i < n; i++)
+      putdirent(buf + i*desize, &de[i]);
+    iappend(inum, buf, n * desize);
+    return;
+  }
+
+  // Smallest table with no overfull leaf.
+  for(depth = 1; ; depth++){
+    assert(depth <= dxmaxdepth() && depth <= DXMAXDEPTH);
+    bzero(count, sizeof(count));
+    max = 0;
+    for(i = 2; i < n; i++){
+      k = dirhash(de[i].name) & ((1 << depth) - 1);
+      if(++count[k] > max)
+        max = count[k];
+    }
+    if(max <= DIRPB)
+      break;
+  }
+
+  bzero(buf, sizeof(buf));
+  putdirent(buf, &de[0]);
+  putdirent(buf + desize, &de[1]);
+  *dxbyte(buf, 0) = depth;
+  *dxbyte(buf, 1) = DXMAGIC;
+  for(k = 0; k < (1 << depth); k++){
+    *dxbyte(buf, 2+2*k) = k + 1;
+    *dxbyte(buf, 3+2*k) = (k + 1) >> 8;
+  }
+  iappend(inum, buf, BSIZE);
+
+  for(k = 0; k < (1 << depth); k++){
+    bzero(buf, sizeof(buf));
+    j = 0;
+    for(i = 2; i < n; i++)
+      if((dirhash(de[i].name) & ((1 << depth) - 1)) == k)
+        putdirent(buf + desize * j++, &de[i]);
+    iappend(inum, buf, BSIZE);
+  }
+
+  rinode(inum, &din);
+  din.major = xshort(D_INDEXED);
+  winode(inum, &din);
+}
@@ -6,15 +6,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-char buf[512];
-
 void
 cat(int fd)
 {
   int n;
 
-  while((n = read(fd, buf, sizeof(buf))) > 0)
-    write(1, buf, n);
+  while((n = sendfile(1, fd, 8192)) > 0)
+    ;
   if(n < 0){
     printf("cat: read error\n");
     exit(1);
@@ -23,19 +23,22 @@ inum(char *path)
 }
 
 void
-dirent_by_inum(char *dir_path, int inum, struct dirent *res)
+dirent_by_inum(char *dir_path, int inum, struct dirstat *res)
 {
-  struct dirent de;
-  int dir;
+  struct dirstat ds[16];
+  int dir, i, n;
 
   dir = open(dir_path, O_RDONLY);
-  while(read(dir, &de, sizeof(de)) == sizeof(de)){
-    if(de.inum == inum){
-      break;
+  while((n = getdents(dir, ds, 16)) > 0){
+    for(i = 0; i < n; i++){
+      if(ds[i].ino == inum){
+        *res = ds[i];
+        close(dir);
+        return;
+      }
     }
   }
   close(dir);
-  *res = de;
 }
 
 void
@@ -52,7 +55,7 @@ main(int argc, char *argv[])
   char res[256] = "";
 
   while(inum(cur) != inum(parent)){
-    struct dirent cur_dirent;
+    struct dirstat cur_dirent;
     dirent_by_inum(parent, inum(cur), &cur_dirent);
     strprepend(res, cur_dirent.name, sizeof(res));
     strprepend(res, "/", sizeof(res));
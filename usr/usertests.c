@@ -1374,6 +1374,42 @@ iref(void)
   printf(1, "empty file name OK\n");
 }
 
+// a process that grew its fd table past NOFILE must not leave
+// stale files behind for the next process in its proc slot.
+void
+fdgrowtest(void)
+{
+  int i, k, pid;
+
+  printf(1, "fd grow test\n");
+
+  for(k = 0; k < 2; k++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(i = 3; i < NOFILE; i++){
+        if(close(i) == 0){
+          printf(1, "fd %d open in new process\n", i);
+          exit();
+        }
+      }
+      for(i = 0; i < 2*NOFILE; i++){
+        if(open("README", 0) < 0){
+          printf(1, "open %d failed\n", i);
+          exit();
+        }
+      }
+      exit();
+    }
+    wait();
+  }
+
+  printf(1, "fd grow test OK\n");
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -1750,6 +1786,7 @@ main(int argc, char *argv[])
   unlinkread();
   dirfile();
   iref();
+  fdgrowtest();
   forktest();
   bigdir(); // slow
   exectest();
@@ -1,5 +1,6 @@
 #include <xv6/param.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include "defs.h"
 #include "gaia.h"
 #include "memlayout.h"
@@ -185,7 +186,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > MMAPBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
@@ -306,7 +307,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -341,3 +342,198 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   return 0;
 }
 
+// Copy len bytes from user address va in page table pgdir to p.
+// The counterpart of copyout(), for reading another process's
+// memory.
+int
+copyin(pde_t *pgdir, void *p, uint va, uint len)
+{
+  char *buf, *pa0;
+  uint n, va0;
+
+  buf = (char*)p;
+  while(len > 0){
+    va0 = (uint)PGROUNDDOWN(va);
+    pa0 = uva2ka(pgdir, (char*)va0);
+    if(pa0 == 0)
+      return -1;
+    n = PGSIZE - (va - va0);
+    if(n > len)
+      n = len;
+    memmove(buf, pa0 + (va - va0), n);
+    len -= n;
+    buf += n;
+    va = va0 + PGSIZE;
+  }
+  return 0;
+}
+
+
+// Find a free range of len bytes for a new mapping in p,
+// first fit from MMAPBASE. Returns 0 if there is none.
+static uint
+vmahole(struct proc *p, uint len)
+{
+  struct vma *v;
+  uint a;
+
+  a = MMAPBASE;
+again:
+  if(len > KERNBASE - a)
+    return 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len && a < v->addr + v->len && v->addr < a + len){
+      a = v->addr + v->len;
+      goto again;
+    }
+  }
+  return a;
+}
+
+// Map len bytes of ip from offset off into p, or zeroed memory if ip
+// is 0. GAIA takes no page faults, so every page is allocated and
+// read in here rather than on first touch. Caller must hold ip->lock.
+// Returns the address of the mapping, or 0 on error.
+uint
+mmapuvm(struct proc *p, struct inode *ip, uint off, uint len, int prot, int flags)
+{
+  struct vma *v, *nv;
+  char *mem;
+  uint a, i;
+  int perm;
+
+  len = PGROUNDUP(len);
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len == 0){
+      nv = v;
+      break;
+    }
+  if(nv == 0 || len == 0 || (a = vmahole(p, len)) == 0)
+    return 0;
+
+  perm = PTE_U;
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  for(i = 0; i < len; i += PGSIZE){
+    if((mem = kalloc_with_color(PGCOLOR(a + i))) == 0)
+      goto bad;
+    memset(mem, 0, PGSIZE);
+    // Past end of file readi fails and the page stays zeroed.
+    if(ip)
+      readi(ip, mem, off + i, PGSIZE);
+    if(mappages(p->pgdir, (char*)(a + i), PGSIZE, v2p(mem), perm) < 0){
+      kfree(mem);
+      goto bad;
+    }
+  }
+  nv->addr = a;
+  nv->len = len;
+  nv->prot = prot;
+  nv->flags = flags;
+  return a;
+
+bad:
+  deallocuvm(p->pgdir, a + i, a);
+  return 0;
+}
+
+// Unmap the pages in [addr, addr+len) from p, trimming or splitting
+// the mappings they belong to. Returns -1 if the range is bad or a
+// split needs a free vma slot and there is none.
+int
+munmapuvm(struct proc *p, uint addr, uint len)
+{
+  struct vma *v, *nv;
+  uint end, vend, lo, hi;
+
+  if(addr % PGSIZE || addr < MMAPBASE || addr >= KERNBASE ||
+     len == 0 || len > KERNBASE - addr)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len == 0)
+      nv = v;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < addr && end < v->addr + v->len && nv == 0)
+      return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    vend = v->addr + v->len;
+    if(v->len == 0 || vend <= addr || end <= v->addr)
+      continue;
+    lo = v->addr > addr ? v->addr : addr;
+    hi = vend < end ? vend : end;
+    deallocuvm(p->pgdir, hi, lo);
+    if(lo == v->addr && hi == vend)
+      v->len = 0;
+    else if(lo == v->addr){
+      v->addr = hi;
+      v->len = vend - hi;
+    } else if(hi == vend)
+      v->len = lo - v->addr;
+    else {
+      nv->addr = hi;
+      nv->len = vend - hi;
+      nv->prot = v->prot;
+      nv->flags = v->flags;
+      v->len = lo - v->addr;
+    }
+  }
+  return 0;
+}
+
+// Copy the pages of p's mappings into pgdir, a page table
+// just made by copyuvm() for a child of p. MAP_SHARED pages
+// are not copied; the child maps the same physical page.
+int
+copyvma(pde_t *pgdir, struct proc *p)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  uint a;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P))
+        panic("copyvma: page not present");
+      if(v->flags & MAP_SHARED){
+        mem = p2v(PTE_ADDR(*pte));
+        kref(mem);
+      } else {
+        if((mem = kalloc_with_color(PGCOLOR(a))) == 0)
+          return -1;
+        memmove(mem, p2v(PTE_ADDR(*pte)), PGSIZE);
+      }
+      if(mappages(pgdir, (char*)a, PGSIZE, v2p(mem), PTE_FLAGS(*pte)) < 0){
+        kfree(mem);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Return 1 if [a, a+n) lies in p's mappings, else 0.
+int
+mapped(struct proc *p, uint a, uint n)
+{
+  struct vma *v;
+  uint m;
+
+  for(;;){
+    for(v = p->vma; v < &p->vma[NVMA]; v++)
+      if(v->len && a >= v->addr && a - v->addr < v->len)
+        break;
+    if(v == &p->vma[NVMA])
+      return 0;
+    m = v->addr + v->len - a;
+    if(n <= m)
+      return 1;
+    a += m;
+    n -= m;
+  }
+}